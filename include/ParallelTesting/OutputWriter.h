@@ -0,0 +1,108 @@
+#ifndef OUTPUT_WRITER_H
+#define OUTPUT_WRITER_H
+
+#include <set>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+#include <stdexcept>
+#include "utils.h"
+
+// Runs save jobs on its own threads through a bounded queue; submit() blocks while the queue is
+// full and drain() waits for every pending job, rethrowing the first failure
+class OutputWriter {
+public:
+    OutputWriter(size_t threads, size_t depth, const std::set<unsigned int>& cores = {}) : _depth(depth) {
+        if (threads == 0 || depth == 0) {
+            throw std::invalid_argument("Output writer needs at least one thread and one queue slot");
+        }
+        for (size_t i = 0; i < threads; ++i) {
+            _workers.emplace_back([this, cores] {
+                pinCurrentThread(cores);
+                work();
+            });
+        }
+    }
+
+    OutputWriter(const OutputWriter&) = delete;
+    OutputWriter& operator=(const OutputWriter&) = delete;
+
+    ~OutputWriter() {
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _idle.wait(lock, [this] { return _jobs.empty() && _running == 0; });
+            _stopping = true;
+        }
+        _ready.notify_all();
+        for (auto& worker : _workers) {
+            worker.join();
+        }
+    }
+
+    void submit(std::function<void()> job) {
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _space.wait(lock, [this] { return _jobs.size() < _depth; });
+            _jobs.push_back(std::move(job));
+        }
+        _ready.notify_one();
+    }
+
+    void drain() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _idle.wait(lock, [this] { return _jobs.empty() && _running == 0; });
+        if (_error) {
+            std::exception_ptr error = _error;
+            _error = nullptr;
+            std::rethrow_exception(error);
+        }
+    }
+
+private:
+    size_t _depth;
+    std::vector<std::thread> _workers;
+    std::deque<std::function<void()>> _jobs;
+    size_t _running = 0;
+    bool _stopping = false;
+    std::exception_ptr _error;
+    std::mutex _mutex;
+    std::condition_variable _ready;
+    std::condition_variable _space;
+    std::condition_variable _idle;
+
+    void work() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (true) {
+            _ready.wait(lock, [this] { return !_jobs.empty() || _stopping; });
+            if (_jobs.empty()) {
+                return;
+            }
+            std::function<void()> job = std::move(_jobs.front());
+            _jobs.pop_front();
+            ++_running;
+            lock.unlock();
+            _space.notify_one();
+
+            try {
+                job();
+            } catch (...) {
+                lock.lock();
+                if (!_error) _error = std::current_exception();
+                lock.unlock();
+            }
+
+            job = nullptr;
+            lock.lock();
+            --_running;
+            if (_jobs.empty() && _running == 0) {
+                _idle.notify_all();
+            }
+        }
+    }
+};
+
+#endif
@@ -3,11 +3,15 @@
 
 #include "TestingData/DataArray.h"
 #include "TestingData/DataImage.h"
+#include "TestingData/DataImageSet.h"
 #include "TestingData/DataMatrix.h"
 #include "TestingData/DataText.h"
 #include "TestingData/DataAudio.h"
 #include "TestingData/DataVideo.h"
+#include "TestingData/DataGraph.h"
+#include "TestingData/DataStringCollection.h"
 #include "TestOptions.h"
+#include "OutputWriter.h"
 #include "utils.h"
 #include "PerformanceEvaluation.h"
 #include "TestingData/Data.h"
@@ -15,6 +19,7 @@
 #include <initializer_list>
 #include <iostream>
 #include <memory>
+#include <set>
 #include <filesystem>
 #include <omp.h>
 #include <stdexcept>
@@ -38,9 +43,9 @@ public:
         double time, time_start, time_end;
         auto& interval = _options.GetInterval();
         const auto &saveOption = _options.GetSaveOption();
+        const CopyStrategy copyStrategy = _options.GetCopyStrategy();
         auto call_function = _function.Function();
         auto function_args = _function.Arguments();
-        auto data_set = _data.DataSet();
         json result;
         result = json::array();
         
@@ -56,15 +61,54 @@ public:
             return;
         }
 
-        for(const auto& data : data_set) {
-            data->read();
+        const auto& asyncSave = _options.GetAsyncSave();
+        std::unique_ptr<OutputWriter> writer;
+        if (asyncSave.threads > 0 && saveOption != SaveOption::notSave) {
+            writer = std::make_unique<OutputWriter>(asyncSave.threads, asyncSave.depth, asyncSave.cores);
+        }
+
+        // Measured threads run on the cores left after the writers and the prefetch
+        std::set<unsigned int> backgroundCores = _data.GetPrefetchCores();
+        if (writer) {
+            backgroundCores.insert(asyncSave.cores.begin(), asyncSave.cores.end());
+        }
+        const std::set<unsigned int> availableCores = currentThreadCores();
+        std::set<unsigned int> measuredCores;
+        if (!backgroundCores.empty()) {
+            for (unsigned int core : availableCores) {
+                if (!backgroundCores.count(core)) {
+                    measuredCores.insert(core);
+                }
+            }
+            if (measuredCores.empty() && !availableCores.empty()) {
+                throw std::invalid_argument("Background cores leave no cores for the measured threads");
+            }
+        }
+        const TeamAffinityGuard affinityGuard(measuredCores.empty() ? std::set<unsigned int>() : availableCores);
+
+        for (size_t data_id = 0; data_id < _data.size(); ++data_id) {
+            auto data = _data.acquire(data_id);
             std::cout << "==============================================" << std::endl;
             std::cout << "Обработка данных: " << data->title() << std::endl;
             std::cout << "==============================================" << std::endl;
             json data_json;
             data_json["title"] = data->title();
             data_json["type"] = data->type();
+            if (!_data.description(data_id).empty()) {
+                data_json["description"] = _data.description(data_id);
+            }
             data_json["data"] = json::array();
+
+            auto save_copy = [&](int args_id, int thread) {
+                if (!writer) {
+                    return data->save_copy(dirname, args_id, thread);
+                }
+                auto [filename, job] = data->detach_copy(dirname, args_id, thread);
+                if (job) {
+                    writer->submit(std::move(job));
+                }
+                return filename;
+            };
             
             for (int args_id = 0; args_id < function_args.size(); args_id++) {
                 const auto& args = function_args[args_id];
@@ -76,8 +120,15 @@ public:
     
                 for(const auto& thread : _options.GetThreads()) {
                     omp_set_num_threads(thread);
+                    if (!measuredCores.empty()) {
+                        pinTeam(measuredCores);
+                    }
+                    data->reset_statistics();
+                    if (writer && asyncSave.cores.empty()) {
+                        writer->drain();
+                    }
                     for(size_t i = 0; i < interval.getSize(); ++i) {
-                        auto full_args = std::tuple_cat(data->copy(), args);
+                        auto full_args = std::tuple_cat(input(*data, copyStrategy), args);
                         time_start = omp_get_wtime();
                         std::apply(call_function, full_args);
                         time_end = omp_get_wtime();
@@ -88,8 +139,11 @@ public:
                     pe.addTime(thread, time);
                     
                     json thread_result;
-                    if (saveOption == SaveOption::saveAll) {
-                        thread_result["processing_data"] = data->save_copy(dirname, args_id + 1, thread);
+                    if (saveOption == SaveOption::saveAll && copyStrategy != CopyStrategy::SharedReadOnly) {
+                        const std::string saved = save_copy(args_id + 1, thread);
+                        if (!saved.empty()) {
+                            thread_result["processing_data"] = saved;
+                        }
                     }
                     auto acceleration = pe.getAcceleration(thread);
                     thread_result["thread"] = thread;
@@ -99,6 +153,10 @@ public:
                     thread_result["cost"] = pe.getCost(thread);
                     thread_result["amdahl_p"] = pe.getAmdahlP(thread, acceleration);
                     thread_result["gustavson_p"] = pe.getGustavsonP(thread, acceleration);
+                    auto statistics = data->statistics();
+                    if (!statistics.empty()) {
+                        thread_result["statistics"] = statistics;
+                    }
                     
                     performance_result.push_back(thread_result);
     
@@ -115,15 +173,20 @@ public:
                     {"performance", performance_result}
                 });
                 
-                if (saveOption == SaveOption::saveArgs) {
-                    data_json["processing_data"] = data->save_copy(dirname, args_id + 1);
+                if (saveOption == SaveOption::saveArgs && copyStrategy != CopyStrategy::SharedReadOnly) {
+                    const std::string saved = save_copy(args_id + 1, 0);
+                    if (!saved.empty()) {
+                        data_json["processing_data"] = saved;
+                    }
                 }
             }
             result.push_back(data_json);
-            data->clear_copy();
-            data->clear();
+            _data.release(data_id, data);
             std::cout << "==============================================\n" << std::endl;
         }
+        if (writer) {
+            writer->drain();
+        }
         
         if (_options.NeedResultFile()) {
             std::filesystem::path result_path = std::filesystem::path(dirname) / "result.json";
@@ -138,6 +201,19 @@ public:
     
 
 private:
+    // Input of one iteration; shared inputs are never written, so run() saves nothing for them
+    template <typename Metadata>
+    static Metadata& input(Data<Metadata>& data, CopyStrategy copyStrategy) {
+        switch (copyStrategy) {
+            case CopyStrategy::RestoreInPlace:
+                return data.restore();
+            case CopyStrategy::SharedReadOnly:
+                return data.share();
+            default:
+                return data.copy();
+        }
+    }
+
     TestOptions& _options;
     DataManager<DataType>& _data;
     FunctionManager<Func, Args...> _function;
@@ -3,14 +3,25 @@
 
 #include <set>
 #include <vector>
+#include <string>
+#include <memory>
+#include <functional>
+#include <future>
+#include <filesystem>
+#include <stdexcept>
+#include <omp.h>
+#include "utils.h"
 #include "ConfidenceInterval.h"
 #include "TestingData/Data.h"
 #include "TestingData/DataArray.h"
 #include "TestingData/DataImage.h"
+#include "TestingData/DataImageSet.h"
 #include "TestingData/DataMatrix.h"
 #include "TestingData/DataText.h"
 #include "TestingData/DataAudio.h"
 #include "TestingData/DataVideo.h"
+#include "TestingData/DataGraph.h"
+#include "TestingData/DataStringCollection.h"
 
 enum class SaveOption {
     saveAll,
@@ -18,6 +29,16 @@ enum class SaveOption {
     notSave
 }; 
 
+// Saved copies are encoded by writer threads off the measured path. Without writer cores the
+// queue is drained before each thread series, the only mode where no saving overlaps a
+// measurement. With them the writers are pinned there and drained at the end; the measured
+// threads are kept off those cores but still share caches and memory bandwidth with them
+struct AsyncSave {
+    size_t threads = 0;                     // 0 saves synchronously
+    size_t depth = 4;
+    std::set<unsigned int> cores;
+};
+
 class TestOptions {
 public:
     TestOptions() 
@@ -57,11 +78,29 @@ public:
         return _resultFile;
     }
 
+    void SetAsyncSave(const AsyncSave& asyncSave) {
+        _asyncSave = asyncSave;
+    }
+
+    const AsyncSave& GetAsyncSave() const {
+        return _asyncSave;
+    }
+
+    void SetCopyStrategy(CopyStrategy copyStrategy) {
+        _copyStrategy = copyStrategy;
+    }
+
+    CopyStrategy GetCopyStrategy() const {
+        return _copyStrategy;
+    }
+
 private:
     std::set<unsigned int> _threads;
     ConfidenceInterval _interval;
     SaveOption _saveOption;
     bool _resultFile;
+    AsyncSave _asyncSave;
+    CopyStrategy _copyStrategy = CopyStrategy::DeepCopy;
 };
 
 template<typename Func, typename... Args>
@@ -102,6 +141,10 @@ struct MetadataTraits<DataArray1D<T>> {
     using MetadataType = MetadataArray1D<T>;
 };
 template<typename T>
+struct MetadataTraits<DataArrayND<T>> {
+    using MetadataType = MetadataArrayND<T>;
+};
+template<typename T>
 struct MetadataTraits<DataMatrix<T>> {
     using MetadataType = MetadataMatrix<T>;
 };
@@ -110,22 +153,50 @@ struct MetadataTraits<DataText> {
     using MetadataType = MetadataText;
 };
 template<>
-struct MetadataTraits<DataImage> {
-    using MetadataType = MetadataImage;
+struct MetadataTraits<DataTextLines> {
+    using MetadataType = MetadataTextLines;
 };
 template<>
-struct MetadataTraits<DataAudio> {
-    using MetadataType = MetadataAudio;
+struct MetadataTraits<DataStringCollection> {
+    using MetadataType = MetadataStringCollection;
+};
+template<typename Layout>
+struct MetadataTraits<BasicDataImage<Layout>> {
+    using MetadataType = typename Layout::Metadata;
+};
+
+template<typename Layout>
+struct MetadataTraits<BasicDataImageSet<Layout>> {
+    using MetadataType = MetadataImageSet<typename Layout::Element>;
+};
+template<typename Layout>
+struct MetadataTraits<BasicDataAudio<Layout>> {
+    using MetadataType = BasicMetadataAudio<Layout>;
 };
 template<>
 struct MetadataTraits<DataVideo> {
     using MetadataType = MetadataVideo;
 };
+template<typename T>
+struct MetadataTraits<DataGraph<T>> {
+    using MetadataType = MetadataGraph<T>;
+};
+
+// Dataset built on demand: the factory runs just before the dataset is tested and the object
+// is released right after. A temporary dataset also removes its source file on release, which
+// suits generated arrays and matrices.
+template <typename T>
+struct DataSpec {
+    std::function<T()> factory;
+    std::string description;
+    bool temporary = false;
+};
 
 template <typename T>
 class DataManager {
 public:
     using MetadataType = typename MetadataTraits<T>::MetadataType;
+    using DataPtr = std::shared_ptr<Data<MetadataType>>;
 
     DataManager(T&& data) {
         add(std::move(data));
@@ -135,22 +206,145 @@ public:
         add(data);
     }
 
+    DataManager(DataSpec<T> spec) {
+        add(std::move(spec));
+    }
+
+    DataManager(std::initializer_list<DataSpec<T>> specs) {
+        add(specs);
+    }
+
+    DataManager(const DataManager&) = delete;
+    DataManager& operator=(const DataManager&) = delete;
+
+    ~DataManager() {
+        if (_prefetched.valid()) {
+            _prefetched.wait();
+        }
+    }
+
     void add(T&& data) {
-        _data.push_back(std::make_shared<T>(std::move(data)));
+        _entries.push_back({std::make_shared<T>(std::move(data)), nullptr, "", false});
     }
 
     void add(std::initializer_list<T> data) {
         for (auto&& value: data) {
-            _data.push_back(std::make_shared<T>(std::move(value)));
+            _entries.push_back({std::make_shared<T>(std::move(value)), nullptr, "", false});
+        }
+    }
+
+    void add(DataSpec<T> spec) {
+        if (!spec.factory) {
+            throw std::invalid_argument("Data spec needs a factory");
+        }
+        _entries.push_back({nullptr, std::move(spec.factory), std::move(spec.description), spec.temporary});
+    }
+
+    void add(std::initializer_list<DataSpec<T>> specs) {
+        for (const auto& spec : specs) {
+            add(spec);
+        }
+    }
+
+    // While dataset k is tested, dataset k + 1 is built and read on a background thread pinned
+    // to cores, which run() keeps free of measured threads. Where affinity cannot be set the
+    // prefetch still overlaps the measurement unpinned
+    void SetPrefetch(bool enabled, const std::set<unsigned int>& cores = {}) {
+        if (enabled && cores.empty()) {
+            throw std::invalid_argument("Prefetch needs cores of its own");
+        }
+        _prefetch = enabled;
+        _prefetchCores = enabled ? cores : std::set<unsigned int>();
+    }
+
+    const std::set<unsigned int>& GetPrefetchCores() const {
+        return _prefetchCores;
+    }
+
+    size_t size() const {
+        return _entries.size();
+    }
+
+    const std::string& description(size_t index) const {
+        return _entries.at(index).description;
+    }
+
+    // Every dataset, unread; datasets given as specs are built here, so prefer acquire()
+    std::vector<DataPtr> DataSet() const {
+        std::vector<DataPtr> data;
+        data.reserve(_entries.size());
+        for (const Entry& entry : _entries) {
+            data.push_back(entry.data ? entry.data : std::make_shared<T>(entry.factory()));
         }
+        return data;
     }
 
-    const auto& DataSet() const {
-        return _data;
+    // Returns dataset index built and read, and starts prefetching the next one
+    DataPtr acquire(size_t index) {
+        DataPtr data;
+        if (_prefetched.valid()) {
+            const size_t prefetchedIndex = _prefetchedIndex;
+            DataPtr prefetched = _prefetched.get();
+            if (prefetchedIndex == index) {
+                data = std::move(prefetched);
+            } else {
+                discard(prefetchedIndex, prefetched);
+            }
+        }
+        if (!data) {
+            data = materialize(_entries.at(index));
+        }
+
+        if (_prefetch && index + 1 < _entries.size()) {
+            _prefetchedIndex = index + 1;
+            _prefetched = std::async(std::launch::async, [this, entry = &_entries[index + 1]] {
+                // Teams started while reading are sized to the prefetch cores instead of every core
+                pinCurrentThread(_prefetchCores);
+                omp_set_num_threads(static_cast<int>(_prefetchCores.size()));
+                return materialize(*entry);
+            });
+        }
+        return data;
+    }
+
+    // Frees the loaded data; datasets built from specs are destroyed as well
+    void release(size_t index, DataPtr& data) {
+        if (!data) {
+            return;
+        }
+        data->clear_copy();
+        discard(index, data);
     }
 
 private:
-    std::vector<std::shared_ptr<Data<MetadataType>>> _data;
+    struct Entry {
+        DataPtr data;
+        std::function<T()> factory;
+        std::string description;
+        bool temporary;
+    };
+
+    std::vector<Entry> _entries;
+    bool _prefetch = false;
+    std::set<unsigned int> _prefetchCores;
+    std::future<DataPtr> _prefetched;
+    size_t _prefetchedIndex = 0;
+
+    static DataPtr materialize(const Entry& entry) {
+        DataPtr data = entry.data ? entry.data : std::make_shared<T>(entry.factory());
+        data->read();
+        return data;
+    }
+
+    void discard(size_t index, DataPtr& data) {
+        data->clear();
+        const Entry& entry = _entries.at(index);
+        if (entry.temporary && !data->source().empty()) {
+            std::error_code ec;
+            std::filesystem::remove(data->source(), ec);
+        }
+        data.reset();
+    }
 };
 
 #endif
\ No newline at end of file
@@ -6,6 +6,13 @@
 #include <string>
 #include <sstream>
 #include <chrono>
+#include <set>
+#include <utility>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 template <typename T, typename = void>
 struct is_convertible_to_string : std::false_type {};
@@ -48,4 +55,66 @@ inline std::string getCurrentDateTime() {
     return oss.str();
 }
 
-#endif
\ No newline at end of file
+// Restricts the calling thread, and threads it starts later, to the given cores; an empty set
+// or a platform without affinity control leaves it unpinned
+inline void pinCurrentThread(const std::set<unsigned int>& cores) {
+#if defined(__linux__)
+    if (cores.empty()) {
+        return;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (unsigned int core : cores) {
+        CPU_SET(core, &set);
+    }
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    (void)cores;
+#endif
+}
+
+// Cores the calling thread may run on; empty on a platform without affinity control
+inline std::set<unsigned int> currentThreadCores() {
+    std::set<unsigned int> cores;
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (pthread_getaffinity_np(pthread_self(), sizeof(set), &set) == 0) {
+        for (unsigned int core = 0; core < CPU_SETSIZE; ++core) {
+            if (CPU_ISSET(core, &set)) {
+                cores.insert(core);
+            }
+        }
+    }
+#endif
+    return cores;
+}
+
+// Pins the calling thread and the OpenMP team it currently starts. The runtime keeps team
+// threads between parallel regions, so later regions of the same size stay on these cores
+inline void pinTeam(const std::set<unsigned int>& cores) {
+    pinCurrentThread(cores);
+    #pragma omp parallel
+    pinCurrentThread(cores);
+}
+
+// Puts the calling thread and its OpenMP team back on cores when leaving the scope, also
+// when an exception leaves it; an empty set restores nothing
+class TeamAffinityGuard {
+public:
+    explicit TeamAffinityGuard(std::set<unsigned int> cores) : _cores(std::move(cores)) {}
+
+    TeamAffinityGuard(const TeamAffinityGuard&) = delete;
+    TeamAffinityGuard& operator=(const TeamAffinityGuard&) = delete;
+
+    ~TeamAffinityGuard() {
+        if (!_cores.empty()) {
+            pinTeam(_cores);
+        }
+    }
+
+private:
+    std::set<unsigned int> _cores;
+};
+
+#endif
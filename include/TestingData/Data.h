@@ -1,6 +1,7 @@
 #ifndef DATA_H
 #define DATA_H
 
+#include <map>
 #include <sstream>
 #include <string>
 #include <variant>
@@ -13,12 +14,293 @@
 #include <fstream>
 #include <stdexcept>
 #include <filesystem>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <exception>
+#include <iterator>
+#include <functional>
+#include <utility>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 enum class NumberFillType {
     Ascending,
     Descending
 };
 
+// How the tested function receives its input on every iteration
+enum class CopyStrategy {
+    DeepCopy,           // a freshly allocated copy
+    RestoreInPlace,     // the previous copy overwritten from the source
+    SharedReadOnly      // the source itself, for functions that never write their input
+};
+
+constexpr size_t DataAlignment = 64;
+
+inline size_t alignedSize(size_t size) {
+    return (size + DataAlignment - 1) / DataAlignment * DataAlignment;
+}
+
+inline void parallelCopy(void* destination, const void* source, size_t bytes) {
+    const size_t chunk = 1 << 22;
+    const size_t chunks = (bytes + chunk - 1) / chunk;
+    #pragma omp parallel for schedule(static) if(chunks > 1)
+    for (size_t i = 0; i < chunks; ++i) {
+        std::memcpy(static_cast<char*>(destination) + i * chunk, static_cast<const char*>(source) + i * chunk, std::min(chunk, bytes - i * chunk));
+    }
+}
+
+class AlignedBuffer {
+public:
+    AlignedBuffer() = default;
+
+    explicit AlignedBuffer(size_t size) {
+        resize(size);
+    }
+
+    AlignedBuffer(const AlignedBuffer& other) {
+        resize(other._size);
+        parallelCopy(_data, other._data, _size);
+    }
+
+    AlignedBuffer(AlignedBuffer&& other) noexcept : _data(other._data), _size(other._size), _mapped(other._mapped) {
+        other._data = nullptr;
+        other._size = 0;
+        other._mapped = false;
+    }
+
+    AlignedBuffer& operator=(AlignedBuffer other) noexcept {
+        std::swap(_data, other._data);
+        std::swap(_size, other._size);
+        std::swap(_mapped, other._mapped);
+        return *this;
+    }
+
+    // Maps size bytes of a file from a page-aligned offset copy-on-write: pages are read on
+    // first access and writes stay private to the buffer. Without mmap the bytes are read.
+    static AlignedBuffer map(const std::string& filename, size_t offset, size_t size) {
+        AlignedBuffer buffer;
+        if (size == 0) {
+            return buffer;
+        }
+#if defined(__unix__) || defined(__APPLE__)
+        const int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("Failed to open " + filename);
+        }
+        void* data = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, static_cast<off_t>(offset));
+        ::close(fd);
+        if (data == MAP_FAILED) {
+            throw std::runtime_error("Failed to map " + filename);
+        }
+        buffer._data = static_cast<uint8_t*>(data);
+        buffer._size = size;
+        buffer._mapped = true;
+#else
+        std::ifstream file(filename, std::ios::binary);
+        buffer.resize(size);
+        file.seekg(static_cast<std::streamoff>(offset));
+        file.read(reinterpret_cast<char*>(buffer._data), static_cast<std::streamsize>(size));
+        if (!file) {
+            throw std::runtime_error("Failed to read " + filename);
+        }
+#endif
+        return buffer;
+    }
+
+    ~AlignedBuffer() {
+        reset();
+    }
+
+    void resize(size_t size) {
+        reset();
+        if (size > 0) {
+            _data = static_cast<uint8_t*>(std::aligned_alloc(DataAlignment, alignedSize(size)));
+            if (!_data) throw std::bad_alloc();
+            _size = size;
+        }
+    }
+
+    void reset() {
+#if defined(__unix__) || defined(__APPLE__)
+        if (_mapped) {
+            ::munmap(_data, _size);
+        } else {
+            std::free(_data);
+        }
+#else
+        std::free(_data);
+#endif
+        _data = nullptr;
+        _size = 0;
+        _mapped = false;
+    }
+
+    uint8_t* data() const { return _data; }
+    size_t size() const { return _size; }
+    bool empty() const { return _size == 0; }
+
+private:
+    uint8_t* _data = nullptr;
+    size_t _size = 0;
+    bool _mapped = false;
+};
+
+// Single-pass sequence of items produced in order by a background thread into a bounded
+// ring of preallocated slots. The consumer holds one item at a time and its slot is only
+// reused after next() has moved past it; producer errors surface in item order.
+template <typename Item>
+class PrefetchStream {
+public:
+    class iterator {
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = Item;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const Item*;
+        using reference = const Item&;
+
+        iterator() = default;
+        explicit iterator(PrefetchStream* stream) : _stream(stream), _item(stream->next()) {}
+
+        reference operator*() const { return *_item; }
+        pointer operator->() const { return _item; }
+        iterator& operator++() {
+            _item = _stream->next();
+            return *this;
+        }
+        bool operator==(const iterator& other) const { return _item == other._item; }
+        bool operator!=(const iterator& other) const { return _item != other._item; }
+
+    private:
+        PrefetchStream* _stream = nullptr;
+        const Item* _item = nullptr;
+    };
+
+    // fill(index, slot, item) produces item number index in slot memory of slotBytes bytes and
+    // returns false when the sequence ends early; at most count items are produced
+    template <typename Fill>
+    PrefetchStream(size_t count, size_t depth, size_t slotBytes, Fill fill) : _state(std::make_unique<State>()) {
+        if (depth == 0) {
+            throw std::invalid_argument("Prefetch depth must be positive");
+        }
+        _state->count = count;
+        _state->slotBytes = alignedSize(slotBytes);
+        _state->slots.resize(depth * _state->slotBytes);
+        _state->ring.resize(depth);
+        State* state = _state.get();
+        _state->worker = std::thread([state, fill = std::move(fill)]() mutable { produce(state, fill); });
+    }
+
+    PrefetchStream(PrefetchStream&&) = default;
+    PrefetchStream& operator=(PrefetchStream&& other) {
+        stop();
+        _state = std::move(other._state);
+        return *this;
+    }
+
+    ~PrefetchStream() {
+        stop();
+    }
+
+    // Returns the next item, or nullptr after the last one
+    const Item* next() {
+        std::unique_lock<std::mutex> lock(_state->mutex);
+        if (_state->holding) {
+            ++_state->consumed;
+            _state->holding = false;
+            _state->notFull.notify_one();
+        }
+        _state->notEmpty.wait(lock, [this] { return _state->produced > _state->consumed || _state->error || _state->finished; });
+        if (_state->produced > _state->consumed) {
+            _state->current = _state->ring[_state->consumed % _state->ring.size()];
+            _state->holding = true;
+            return &_state->current;
+        }
+        if (_state->error) {
+            std::rethrow_exception(_state->error);
+        }
+        return nullptr;
+    }
+
+    iterator begin() { return iterator(this); }
+    iterator end() { return iterator(); }
+
+private:
+    struct State {
+        size_t count = 0;
+        size_t slotBytes = 0;
+        AlignedBuffer slots;
+        std::vector<Item> ring;
+        Item current{};
+        size_t produced = 0;
+        size_t consumed = 0;
+        bool holding = false;
+        bool finished = false;
+        bool stopping = false;
+        std::exception_ptr error;
+        std::mutex mutex;
+        std::condition_variable notFull;
+        std::condition_variable notEmpty;
+        std::thread worker;
+    };
+    std::unique_ptr<State> _state;
+
+    template <typename Fill>
+    static void produce(State* state, Fill& fill) {
+        try {
+            for (size_t i = 0; i < state->count; ++i) {
+                size_t slot = 0;
+                {
+                    std::unique_lock<std::mutex> lock(state->mutex);
+                    state->notFull.wait(lock, [state] { return state->produced - state->consumed < state->ring.size() || state->stopping; });
+                    if (state->stopping) return;
+                    slot = state->produced % state->ring.size();
+                }
+
+                Item item{};
+                if (!fill(i, state->slots.data() + slot * state->slotBytes, item)) {
+                    break;
+                }
+
+                {
+                    std::lock_guard<std::mutex> lock(state->mutex);
+                    state->ring[slot] = item;
+                    ++state->produced;
+                }
+                state->notEmpty.notify_one();
+            }
+            {
+                std::lock_guard<std::mutex> lock(state->mutex);
+                state->finished = true;
+            }
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            state->error = std::current_exception();
+        }
+        state->notEmpty.notify_one();
+    }
+
+    void stop() {
+        if (!_state || !_state->worker.joinable()) return;
+        {
+            std::lock_guard<std::mutex> lock(_state->mutex);
+            _state->stopping = true;
+        }
+        _state->notFull.notify_one();
+        _state->worker.join();
+    }
+};
+
 template <typename Metadata>
 class Data {
 public:
@@ -26,13 +308,29 @@ public:
     virtual void clear() = 0;
     virtual Metadata& copy() = 0;
     virtual void clear_copy() = 0;
+    // Refreshes the existing copy from the source without reallocating it
+    virtual Metadata& restore() { return copy(); }
+    // Metadata over the source data; types that cannot expose it fall back to a copy
+    virtual Metadata& share() { return copy(); }
+    // Returns the saved file name, or an empty name for data without a copy to save
     virtual const std::string save_copy(const std::string& dirname, int args_id, int thread_num = 0) const = 0;
+    // Moves the current copy into a job that writes it later, so encoding can run off the
+    // measured path. Returns the file name and the job; by default the copy is saved right away
+    // and the job is empty.
+    virtual std::pair<std::string, std::function<void()>> detach_copy(const std::string& dirname, int args_id, int thread_num = 0) {
+        return {save_copy(dirname, args_id, thread_num), nullptr};
+    }
     virtual const std::string title() const = 0;
     virtual const std::string type() const = 0;
+    const std::string& source() const { return _filename; }
+    // Counters collected while the tested function runs, reported per thread count
+    virtual std::map<std::string, size_t> statistics() const { return {}; }
+    virtual void reset_statistics() {}
     virtual ~Data() = default;
 protected:
     std::string _filename;
     Metadata _copy;
+    Metadata _view;
 
     virtual void save(bool saveCopy = false, int args_id = 0, int thread_num = 0, const std::string& filename = "") const = 0;
     virtual void load() = 0;
@@ -2,95 +2,220 @@
 #define DATA_ARRAY_H
 
 #include "Data.h"
+#include <cstdint>
 #include <filesystem>
+#include <limits>
 #include <string>
+#include <tuple>
 
 template <typename T>
 using MetadataArray1D = std::tuple<T*, size_t>;
 
 template <typename T>
-class DataArray1D : public Data<MetadataArray1D<T>> {
+using MetadataArrayND = std::tuple<
+    T*,             // Base pointer
+    const size_t*,  // Extents
+    const size_t*,  // Strides in elements
+    size_t          // Rank
+>;
+
+template <typename T, typename Metadata>
+class DataArrayBase : public Data<Metadata> {
 public:
-    DataArray1D(const std::string &filename) {
-        this->_filename = filename;
-    }
-
-    DataArray1D(T* array, size_t size, const char* file_path = "") {
-        _data.resize(size);
-        for (size_t i = 0; i < size; i++) {
-            _data[0] = array[0];
-        }
-        std::string filename = std::string(file_path);
-        if (filename.empty()) {
-            this->_filename = this->getCurrentDateTime() + ".array";    
-        } else {
-            this->_filename = filename;
+    void read() override {
+        if (!this->_filename.empty()) {
+            this->load();
         }
-        save(false, 0, 0, this->_filename);
+    }
 
-        clear();
+    void clear() override {
+        _data.clear();
+        _data.shrink_to_fit();
     }
 
-    DataArray1D(size_t size, T min, T max, const char* file_path = "") {
-        _data.resize(size);
-        fillRandom(min, max);
-        
+protected:
+    std::vector<T> _data;
+
+    void setFilename(const char* file_path) {
         std::string filename = std::string(file_path);
         if (filename.empty()) {
-            this->_filename = this->getCurrentDateTime() + ".array";    
+            this->_filename = this->getCurrentDateTime() + ".array";
         } else {
             this->_filename = filename;
         }
-        save(false, 0, 0, this->_filename);
-
-        clear();
     }
-    
-    DataArray1D(size_t size, NumberFillType type, T start, T step, size_t stepInterval, const char* file_path = "") {
-        _data.resize(size);
+
+    void fill(NumberFillType type, T start, T step, size_t stepInterval) {
         if (type == NumberFillType::Ascending) {
-            fillAscending(start, step, stepInterval);   
+            fillAscending(start, step, stepInterval);
         } else if (type == NumberFillType::Descending) {
             fillDescending(start, step, stepInterval);
         } else {
             throw std::invalid_argument("Invalid fill type");
         }
-        std::string filename = std::string(file_path);
-        if (filename.empty()) {
-            this->_filename = this->getCurrentDateTime() + ".array";    
+    }
+
+    void fillRandom(T min, T max) {
+        std::random_device rd;
+        std::mt19937 gen(rd());
+
+        if constexpr (std::is_integral_v<T>) {
+            std::uniform_int_distribution<T> dis(min, max);
+            std::generate(_data.begin(), _data.end(), [&]() { return dis(gen); });
         } else {
-            this->_filename = filename;
+            std::uniform_real_distribution<T> dis(min, max);
+            std::generate(_data.begin(), _data.end(), [&]() { return dis(gen); });
         }
-        save(false, 0, 0, this->_filename);
+    }
 
-        clear();
+    void fillAscending(T start, T step, size_t stepInterval) {
+        T current = start;
+        for (size_t i = 0; i < _data.size(); ++i) {
+            _data[i] = current;
+            if ((i + 1) % stepInterval == 0) {
+                current += step;
+            }
+        }
     }
 
-    void read() override {
-        if (!this->_filename.empty()) {
-            load();
+    void fillDescending(T start, T step, size_t stepInterval) {
+        T current = start;
+        for (size_t i = 0; i < _data.size(); ++i) {
+            _data[i] = current;
+            if ((i + 1) % stepInterval == 0) {
+                current -= step;
+            }
         }
     }
 
-    void clear() override {
-        _data.clear();
-        _data.shrink_to_fit();
+    // Dimensions are written after the elements, so N-D files stay readable as flat 1D arrays
+    void writeFile(const std::string& filename, const T* data, const std::vector<size_t>& dimensions = {}) const {
+        std::ofstream file(filename, std::ios::binary);
+        if (!file) throw std::runtime_error("Cannot open file");
+
+        const uint64_t type_size = sizeof(T);
+        const uint64_t size = _data.size();
+        file.write(reinterpret_cast<const char*>(&type_size), sizeof(type_size));
+        file.write(reinterpret_cast<const char*>(&size), sizeof(size));
+        file.write(reinterpret_cast<const char*>(data), size * sizeof(T));
+
+        if (!dimensions.empty()) {
+            const uint64_t rank = dimensions.size();
+            file.write(reinterpret_cast<const char*>(&rank), sizeof(rank));
+            for (size_t dim : dimensions) {
+                const uint64_t value = dim;
+                file.write(reinterpret_cast<const char*>(&value), sizeof(value));
+            }
+        }
+    }
+
+    std::vector<size_t> readFile() {
+        std::ifstream file(this->_filename, std::ios::binary);
+        if (!file) throw std::runtime_error("Cannot open file");
+
+        uint64_t type_size, size;
+        file.read(reinterpret_cast<char*>(&type_size),sizeof(type_size));
+        file.read(reinterpret_cast<char*>(&size),sizeof(size));
+        if (!file || type_size != sizeof(T)) {
+            throw std::runtime_error("Array file element size does not match the array type");
+        }
+        _data.resize(size);
+        file.read(reinterpret_cast<char*>(_data.data()),size * sizeof(T));
+        if (!file) {
+            throw std::runtime_error("Array file is truncated");
+        }
+
+        std::vector<size_t> dimensions;
+        uint64_t rank;
+        if (file.read(reinterpret_cast<char*>(&rank), sizeof(rank))) {
+            dimensions.resize(rank);
+            for (auto& dim : dimensions) {
+                uint64_t value;
+                file.read(reinterpret_cast<char*>(&value), sizeof(value));
+                dim = value;
+            }
+            if (!file) {
+                throw std::runtime_error("Array file is truncated");
+            }
+            size_t elements = 1;
+            for (size_t dim : dimensions) {
+                if (dim != 0 && elements > std::numeric_limits<size_t>::max() / dim) {
+                    throw std::runtime_error("Array dimensions overflow");
+                }
+                elements *= dim;
+            }
+            if (elements != size) {
+                throw std::runtime_error("Array dimensions do not match the element count");
+            }
+        }
+        if (dimensions.empty()) {
+            dimensions.push_back(size);
+        }
+        return dimensions;
+    }
+};
+
+template <typename T>
+class DataArray1D : public DataArrayBase<T, MetadataArray1D<T>> {
+public:
+    DataArray1D(const std::string &filename) {
+        this->_filename = filename;
+    }
+
+    DataArray1D(T* array, size_t size, const char* file_path = "") {
+        this->_data.assign(array, array + size);
+        this->setFilename(file_path);
+        save(false, 0, 0, this->_filename);
+
+        this->clear();
+    }
+
+    DataArray1D(size_t size, T min, T max, const char* file_path = "") {
+        this->_data.resize(size);
+        this->fillRandom(min, max);
+        this->setFilename(file_path);
+        save(false, 0, 0, this->_filename);
+
+        this->clear();
+    }
+
+    DataArray1D(size_t size, NumberFillType type, T start, T step, size_t stepInterval, const char* file_path = "") {
+        this->_data.resize(size);
+        this->fill(type, start, step, stepInterval);
+        this->setFilename(file_path);
+        save(false, 0, 0, this->_filename);
+
+        this->clear();
     }
 
     MetadataArray1D<T>& copy() override {
         clear_copy();
-        
-        T* copy = new T[_data.size()];
-        std::copy(_data.begin(), _data.end(), copy);
-        this->_copy = std::make_tuple(copy, _data.size());
+
+        T* copy = new T[this->_data.size()];
+        std::copy(this->_data.begin(), this->_data.end(), copy);
+        this->_copy = std::make_tuple(copy, this->_data.size());
+        return this->_copy;
+    }
+
+    MetadataArray1D<T>& restore() override {
+        if (!std::get<0>(this->_copy)) {
+            return copy();
+        }
+        parallelCopy(std::get<0>(this->_copy), this->_data.data(), this->_data.size() * sizeof(T));
         return this->_copy;
     }
-    
+
+    MetadataArray1D<T>& share() override {
+        this->_view = std::make_tuple(this->_data.data(), this->_data.size());
+        return this->_view;
+    }
+
     void clear_copy() override {
         try {
             auto data = std::get<0>(this->_copy);
             if (data) {
                 delete[] static_cast<T*>(data);
+                std::get<0>(this->_copy) = nullptr;
             }
         } catch (const std::bad_variant_access& e) {
             return;
@@ -99,8 +224,8 @@ public:
 
     const std::string save_copy(const std::string& dirname, int args_id, int thread_num) const override {
         try {
-            auto data = std::get<0>(this->_copy); 
-            if (data) { 
+            auto data = std::get<0>(this->_copy);
+            if (data) {
                 std::string filename = "proc" + this->proc_data_str(args_id, thread_num) + "_" + this->_filename;
                 std::filesystem::path file_path = std::filesystem::path(dirname) / filename;
                 save(true, args_id, thread_num, file_path);
@@ -114,216 +239,216 @@ public:
     }
 
     const std::string title() const override {
-        return "Одномерный массив с количеством элементов: " + std::to_string(_data.size());
+        return "Одномерный массив с количеством элементов: " + std::to_string(this->_data.size());
     }
 
     const std::string type() const override {
         return std::string("array");
     }
 
-    
 private:
-    std::vector<T> _data;
+    void save(bool saveCopy, int args_id, int thread_num, const std::string& filename) const override {
+        const T* data;
+        if (saveCopy) {
+            data = static_cast<T*>(std::get<0>(this->_copy));
+        } else {
+            data = this->_data.data();
+        }
+        this->writeFile(filename, data);
+    }
 
-    void fillRandom(T min, T max) {
-        std::random_device rd;
-        std::mt19937 gen(rd());
+    void load() override {
+        this->readFile();
+    }
+};
 
-        if constexpr (std::is_integral_v<T>) {
-            std::uniform_int_distribution<T> dis(min, max);
-            std::generate(_data.begin(), _data.end(), [&]() { return dis(gen); });
-        } else {
-            std::uniform_real_distribution<T> dis(min, max);
-            std::generate(_data.begin(), _data.end(), [&]() { return dis(gen); });
+template <typename T>
+class DataArrayND : public DataArrayBase<T, MetadataArrayND<T>> {
+public:
+    DataArrayND(const std::string &filename, const std::vector<size_t>& padding = {}) : _padding(padding) {
+        this->_filename = filename;
+    }
+
+    DataArrayND(const T* array, const std::vector<size_t>& dimensions, const std::vector<size_t>& padding = {}, const char* file_path = "")
+        : _dimensions(dimensions), _padding(padding) {
+        initialize();
+        std::copy(array, array + this->_data.size(), this->_data.begin());
+        this->setFilename(file_path);
+        save(false, 0, 0, this->_filename);
+
+        this->clear();
+    }
+
+    DataArrayND(const std::vector<size_t>& dimensions, T min, T max, const std::vector<size_t>& padding = {}, const char* file_path = "")
+        : _dimensions(dimensions), _padding(padding) {
+        initialize();
+        this->fillRandom(min, max);
+        this->setFilename(file_path);
+        save(false, 0, 0, this->_filename);
+
+        this->clear();
+    }
+
+    DataArrayND(const std::vector<size_t>& dimensions, NumberFillType type, T start, T step, size_t stepInterval, const std::vector<size_t>& padding = {}, const char* file_path = "")
+        : _dimensions(dimensions), _padding(padding) {
+        initialize();
+        this->fill(type, start, step, stepInterval);
+        this->setFilename(file_path);
+        save(false, 0, 0, this->_filename);
+
+        this->clear();
+    }
+
+    MetadataArrayND<T>& copy() override {
+        clear_copy();
+
+        T* copy = new T[_storageSize]();
+        fillCopy(copy);
+        this->_copy = std::make_tuple(copy, _dimensions.data(), _strides.data(), _dimensions.size());
+        return this->_copy;
+    }
+
+    MetadataArrayND<T>& restore() override {
+        if (!std::get<0>(this->_copy)) {
+            return copy();
         }
+        fillCopy(std::get<0>(this->_copy));
+        return this->_copy;
     }
 
-    void fillAscending(T start, T step, size_t stepInterval) {
-        T current = start;
-        for (size_t i = 0; i < _data.size(); ++i) {
-            _data[i] = current;
-            if ((i + 1) % stepInterval == 0) {
-                current += step;
+    // Padded layouts have no source counterpart, they are restored into a persistent copy instead
+    MetadataArrayND<T>& share() override {
+        if (_storageSize != this->_data.size()) {
+            return restore();
+        }
+        this->_view = std::make_tuple(this->_data.data(), _dimensions.data(), _strides.data(), _dimensions.size());
+        return this->_view;
+    }
+
+    void clear_copy() override {
+        delete[] std::get<0>(this->_copy);
+        std::get<0>(this->_copy) = nullptr;
+    }
+
+    const std::string save_copy(const std::string& dirname, int args_id, int thread_num) const override {
+        if (std::get<0>(this->_copy)) {
+            std::string filename = "proc" + this->proc_data_str(args_id, thread_num) + "_" + this->_filename;
+            std::filesystem::path file_path = std::filesystem::path(dirname) / filename;
+            save(true, args_id, thread_num, file_path);
+            return filename;
+        }
+        throw std::runtime_error("Copy data not found");
+    }
+
+    const std::string title() const override {
+        std::string shape;
+        for (size_t i = 0; i < _dimensions.size(); ++i) {
+            shape += (i == 0 ? "" : " x ") + std::to_string(_dimensions[i]);
+        }
+        return "Многомерный массив размером " + shape + " элементов";
+    }
+
+    const std::string type() const override {
+        return std::string("array_nd");
+    }
+
+private:
+    std::vector<size_t> _dimensions;
+    std::vector<size_t> _padding;
+    std::vector<size_t> _strides;
+    size_t _storageSize = 0;
+
+    void initialize() {
+        if (_dimensions.empty()) throw std::invalid_argument("Empty dimensions");
+        if (_padding.empty()) {
+            _padding.assign(_dimensions.size(), 0);
+        } else if (_padding.size() != _dimensions.size()) {
+            throw std::invalid_argument("Padding rank does not match dimensions");
+        }
+
+        size_t total_size = 1;
+        for (size_t dim: _dimensions) {
+            if (dim == 0) throw std::invalid_argument("Zero dimension");
+            if (dim > SIZE_MAX / total_size) {
+                throw std::overflow_error("Total size overflow");
             }
+            total_size *= dim;
         }
+        this->_data.resize(total_size);
+        computeStrides();
     }
 
-    void fillDescending(T start, T step, size_t stepInterval) {
-        T current = start;
-        for (size_t i = 0; i < _data.size(); ++i) {
-            _data[i] = current;
-            if ((i + 1) % stepInterval == 0) {
-                current -= step;
+    void computeStrides() {
+        _strides.resize(_dimensions.size());
+        _strides.back() = 1;
+        for (int i = _dimensions.size() - 2; i >= 0; --i) {
+            const size_t extent = _dimensions[i + 1] + _padding[i + 1];
+            if (extent > SIZE_MAX / _strides[i + 1]) {
+                throw std::overflow_error("Stride computation overflow");
             }
+            _strides[i] = _strides[i + 1] * extent;
+        }
+        const size_t extent = _dimensions[0] + _padding[0];
+        if (extent > SIZE_MAX / _strides[0]) {
+            throw std::overflow_error("Stride computation overflow");
+        }
+        _storageSize = _strides[0] * extent;
+    }
+
+    // Rows land at their padded offsets; padding is only zeroed by the allocation in copy()
+    void fillCopy(T* copy) const {
+        if (_storageSize == this->_data.size()) {
+            parallelCopy(copy, this->_data.data(), this->_data.size() * sizeof(T));
+            return;
         }
+        const size_t row = _dimensions.back();
+        const size_t rows = this->_data.size() / row;
+        #pragma omp parallel for schedule(static)
+        for (size_t r = 0; r < rows; ++r) {
+            std::copy_n(this->_data.begin() + r * row, row, copy + storageOffset(r));
+        }
+    }
+
+    // Offset of the dense row `row` (all indices but the last) in the padded layout
+    size_t storageOffset(size_t row) const {
+        size_t offset = 0;
+        for (int i = _dimensions.size() - 2; i >= 0; --i) {
+            offset += (row % _dimensions[i]) * _strides[i];
+            row /= _dimensions[i];
+        }
+        return offset;
     }
 
     void save(bool saveCopy, int args_id, int thread_num, const std::string& filename) const override {
-        const T* data;
-        if (saveCopy) {
-            data = static_cast<T*>(std::get<0>(this->_copy));
-        } else {
-            data = _data.data();
+        if (!saveCopy) {
+            this->writeFile(filename, this->_data.data(), _dimensions);
+            return;
         }
-        
-        std::ofstream file(filename, std::ios::binary);
-        if (!file) throw std::runtime_error("Cannot open file");
 
-        const uint64_t type_size = sizeof(T);
-        const uint64_t size = _data.size();
-        file.write(reinterpret_cast<const char*>(&type_size), sizeof(type_size));
-        file.write(reinterpret_cast<const char*>(&size), sizeof(size));
-        file.write(reinterpret_cast<const char*>(data), size * sizeof(T));
+        const T* copy = std::get<0>(this->_copy);
+        if (_storageSize == this->_data.size()) {
+            this->writeFile(filename, copy, _dimensions);
+            return;
+        }
+
+        std::vector<T> dense(this->_data.size());
+        const size_t row = _dimensions.back();
+        const size_t rows = dense.size() / row;
+        #pragma omp parallel for schedule(static)
+        for (size_t r = 0; r < rows; ++r) {
+            std::copy_n(copy + storageOffset(r), row, dense.begin() + r * row);
+        }
+        this->writeFile(filename, dense.data(), _dimensions);
     }
 
     void load() override {
-        std::ifstream file(this->_filename, std::ios::binary);
-        if (!file) throw std::runtime_error("Cannot open file");
-
-        uint64_t type_size, size;
-        file.read(reinterpret_cast<char*>(&type_size),sizeof(type_size));
-        file.read(reinterpret_cast<char*>(&size),sizeof(size));
-        _data.resize(size);
-        file.read(reinterpret_cast<char*>(_data.data()),size * sizeof(T));
+        _dimensions = this->readFile();
+        if (_padding.size() != _dimensions.size()) {
+            if (!_padding.empty()) throw std::invalid_argument("Padding rank does not match dimensions");
+            _padding.assign(_dimensions.size(), 0);
+        }
+        computeStrides();
     }
 };
 
-// template <typename T>
-// class DataArrayND : public Data {
-// public:
-//     DataArrayND(const std::string &filename) {
-//         load(filename);
-//         _filename = filename;
-//     }
-
-//     DataArrayND(size_t size, T min, T max) {
-//         initialize();
-//         fillRandom();
-//         _filename = getCurrentDateTime() + ".array";
-//         save();
-//     }
-    
-//     DataArrayND(size_t size, NumberFillType type, T start, T step, size_t stepInterval) {
-//         initialize();
-//         if (type == NumberFillType::Ascending) {
-//             fillAscending(start, step, stepInterval);
-//         } else if (type == NumberFillType::Descending) {
-//             fillDescending(start, step, stepInterval);
-//         } else {
-//             throw std::invalid_argument("Invalid fill type");
-//         }
-//         _filename = getCurrentDateTime() + ".array";
-//         save();
-//     }
-
-//     void* copy() override {
-//         clear_copy();
-        
-//         T* copy = new T[_data.size()];
-//         std::copy(_data.begin(), _data.end(), copy);
-//         _copy = static_cast<void*>(copy);
-//         return _copy;
-//     }
-    
-//     void clear_copy() override {
-//         if (_copy) {
-//             delete[] static_cast<T*>(_copy);
-//         }
-//     }
-
-//     void save_copy() const override {
-//         save(true);
-//     }
-
-    
-// private:
-//     std::vector<T> _data;
-//     std::vector<size_t> dimensions;
-//     std::vector<size_t> strides;
-
-//     void initialize() {
-//         size_t total_size = 1;
-//         for (size_t dim: dimensions) {
-//             if (dim == 0) throw std::invalid_argument("Zero dimension");
-//             if (dim > SIZE_MAX / total_size) {
-//                 throw std::overflow_error("Total size overflow");
-//             }
-//             total_size *= dim;
-//         }
-//         _data.resize(total_size);
-//         computeStrides();
-//     }
-
-//     void computeStrides() {
-//         strides.resize(dimensions.size());
-//         if (dimensions.empty()) return;
-
-//         strides.back() = 1;
-//         for (int i = dimensions.size() - 2; i >= 0; --i) {
-//             if (dimensions[i + 1] > SIZE_MAX / strides[i + 1]) {
-//                 throw std::overflow_error("Stride computation overflow");
-//             }
-//             strides[i] = strides[i + 1] * dimensions[i + 1];
-//         }
-//     }
-
-//     void fillRandom(T min, T max) {
-//         std::random_device rd;
-//         std::mt19937 gen(rd());
-
-//         if constexpr (std::is_integral_v<T>) {
-//             std::uniform_int_distribution<T> dis(min, max);
-//             std::generate(_data.begin(), _data.end(), [&]() { return dis(gen); });
-//         } else {
-//             std::uniform_real_distribution<T> dis(min, max);
-//             std::generate(_data.begin(), _data.end(), [&]() { return dis(gen); });
-//         }
-//     }
-
-//     void fillAscending(T start, T step, size_t stepInterval) {
-//         T current = start;
-//         for (size_t i = 0; i < _data.size(); ++i) {
-//             _data[i] = current;
-//             if ((i + 1) % stepInterval == 0) {
-//                 current += step;
-//             }
-//         }
-//     }
-
-//     void fillDescending(T start, T step, size_t stepInterval) {
-//         T current = start;
-//         for (size_t i = 0; i < _data.size(); ++i) {
-//             _data[i] = current;
-//             if ((i + 1) % stepInterval == 0) {
-//                 current -= step;
-//             }
-//         }
-//     }
-
-//     void save(bool saveCopy) const override {
-//         std::ofstream file(_filename, std::ios::binary);
-//         if (!file) throw std::runtime_error("Cannot open file");
-
-//         const uint64_t size = _data.size();
-//         T* data;
-//         if (saveCopy) {
-//             data = static_cast<T*>(_copy);
-//         } else {
-//             data = _data.data();
-//         }
-//         file.write(reinterpret_cast<const char*>(&size), sizeof(size));
-//         file.write(reinterpret_cast<const char*>(data), size * sizeof(T));
-//     }
-
-//     void load() override {
-//         std::ifstream file(_filename, std::ios::binary);
-//         if (!file) throw std::runtime_error("Cannot open file");
-
-//         uint64_t size;
-//         file.read(reinterpret_cast<char*>(&size),sizeof(size));
-//         _data.resize(size);
-//         file.read(reinterpret_cast<char*>(_data.data()),size * sizeof(T));
-//     }
-// };
-
-#endif
\ No newline at end of file
+#endif
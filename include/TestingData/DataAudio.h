@@ -2,10 +2,13 @@
 #define DATA_AUDIO_H
 
 #include "Data.h"
+#include "MediaCache.h"
 #include <stdexcept>
 #include <vector>
 #include <cmath>
 #include <memory>
+#include <limits>
+#include <functional>
 
 extern "C" {
 #include <libavcodec/avcodec.h>
@@ -16,12 +19,37 @@ extern "C" {
 #include <libavutil/opt.h>
 }
 
+template <typename Layout>
+class BasicDataAudio;
+struct InterleavedAudioLayout;
+
+// Block of interleaved samples handed out by an AudioChunkStream, valid until the next chunk is requested
+struct AudioChunk {
+    size_t index = 0;
+    size_t firstSample = 0;
+    size_t samples = 0;
+    int channels = 0;
+    float* data = nullptr;
+
+    float& operator()(size_t sampleIndex, int channelIndex) const {
+        return data[sampleIndex * channels + channelIndex];
+    }
+};
+
+using AudioChunkStream = PrefetchStream<AudioChunk>;
+
+// Decodes only chunks in flight instead of the whole file; memory stays at poolChunks chunks
+struct AudioStreaming {
+    size_t chunkSamples = 1 << 16;  // Samples per channel in one chunk
+    size_t poolChunks = 4;          // Chunks decoded ahead, bounds the buffer pool
+};
+
 class AudioBuffer {
 public:
     AudioBuffer(): _data(nullptr), _channels(0) {}
 
-    AudioBuffer(float* data, int channels) 
-        : _data(data), _channels(channels) {}
+    AudioBuffer(float* data, int channels, const BasicDataAudio<InterleavedAudioLayout>* source = nullptr) 
+        : _data(data), _channels(channels), _source(source) {}
 
     void clear() {
         delete[] _data;
@@ -37,62 +65,369 @@ public:
 
     float* data() const { return _data; }
 
+    // Chunks of the buffer in order; for streamed audio the only way to reach the samples.
+    // A stream over loaded samples reads them in place, so the buffer must outlive it
+    AudioChunkStream chunks() const;
+
 private:
     float* _data;
     uint16_t _channels;
+    const BasicDataAudio<InterleavedAudioLayout>* _source = nullptr;
 };
 
-using MetadataAudio = std::tuple<AudioBuffer, size_t, int, uint16_t>;
+// One array per channel, channel(c) starts on a DataAlignment boundary and is zero-padded
+// to stride() samples, so SIMD kernels run over whole vectors without a scalar tail
+class PlanarAudioBuffer {
+public:
+    PlanarAudioBuffer(): _data(nullptr), _channels(0), _stride(0) {}
+
+    PlanarAudioBuffer(float* data, int channels, size_t stride)
+        : _data(data), _channels(channels), _stride(stride) {}
 
-class DataAudio : public Data<MetadataAudio> {
+    float& operator()(size_t sampleIndex, int channelIndex) {
+        return _data[channelIndex * _stride + sampleIndex];
+    }
+
+    const float& operator()(size_t sampleIndex, int channelIndex) const {
+        return _data[channelIndex * _stride + sampleIndex];
+    }
+
+    float* channel(int channelIndex) const { return _data + channelIndex * _stride; }
+    size_t stride() const { return _stride; }
+    float* data() const { return _data; }
+
+private:
+    float* _data;
+    uint16_t _channels;
+    size_t _stride;
+};
+
+struct InterleavedAudioLayout {
+    using Buffer = AudioBuffer;
+    static constexpr bool planar = false;
+    static constexpr AVSampleFormat sampleFormat = AV_SAMPLE_FMT_FLT;
+};
+
+struct PlanarAudioLayout {
+    using Buffer = PlanarAudioBuffer;
+    static constexpr bool planar = true;
+    static constexpr AVSampleFormat sampleFormat = AV_SAMPLE_FMT_FLTP;
+};
+
+enum class AudioSignal {
+    SineSweep,      // Exponential sweep from 20 Hz to 20 kHz or 0.45 of the sample rate
+    Chirp,          // Linear sweep over the same range
+    Multitone,      // Eight log-spaced tones with random phases
+    WhiteNoise,
+    PinkNoise,      // Voss-McCartney noise with 16 octave rows
+    ImpulseTrain    // Unit impulses ten times per second
+};
+
+template <typename Layout>
+using BasicMetadataAudio = std::tuple<typename Layout::Buffer, size_t, int, uint16_t>;
+using MetadataAudio = BasicMetadataAudio<InterleavedAudioLayout>;
+using MetadataAudioPlanar = BasicMetadataAudio<PlanarAudioLayout>;
+
+// Decodes the first decodable audio stream of a file in order into interleaved float samples
+class AudioStreamDecoder {
 public:
-    DataAudio(const std::string& filename) {
-        _filename = filename;
+    explicit AudioStreamDecoder(const std::string& filename) {
+        try {
+            open(filename);
+        } catch (...) {
+            close();
+            throw;
+        }
+    }
+
+    AudioStreamDecoder(const AudioStreamDecoder&) = delete;
+    AudioStreamDecoder& operator=(const AudioStreamDecoder&) = delete;
+
+    ~AudioStreamDecoder() {
+        close();
+    }
+
+    int sampleRate() const { return _codecCtx->sample_rate; }
+    int channels() const { return _codecCtx->ch_layout.nb_channels; }
+
+    size_t estimatedSamples() const {
+        return _fmtCtx->duration > 0 ? static_cast<size_t>(_fmtCtx->duration * sampleRate() / AV_TIME_BASE) : 0;
+    }
+
+    // Sums packet durations without decoding; the decoder is at the end of the stream afterwards
+    size_t countSamples() {
+        const AVStream* stream = _fmtCtx->streams[_streamIndex];
+        size_t samples = 0;
+        while (av_read_frame(_fmtCtx, _pkt) >= 0) {
+            if (_pkt->stream_index == _streamIndex) {
+                if (_pkt->duration > 0) {
+                    samples += av_rescale_q(_pkt->duration, stream->time_base, AVRational{1, sampleRate()});
+                } else {
+                    samples += stream->codecpar->frame_size;
+                }
+            }
+            av_packet_unref(_pkt);
+        }
+        _draining = true;
+        return samples;
+    }
+
+    // Writes up to count interleaved samples, returns how many; fewer only at the end of the stream
+    size_t read(float* out, size_t count) {
+        const size_t channelCount = channels();
+        size_t done = 0;
+        while (done < count) {
+            const size_t available = _pending.size() / channelCount - _pendingOffset;
+            if (available > 0) {
+                const size_t copied = std::min(available, count - done);
+                std::memcpy(out + done * channelCount, _pending.data() + _pendingOffset * channelCount, copied * channelCount * sizeof(float));
+                _pendingOffset += copied;
+                done += copied;
+            } else if (!decodeFrame()) {
+                break;
+            }
+        }
+        return done;
+    }
+
+private:
+    AVFormatContext* _fmtCtx = nullptr;
+    AVCodecContext* _codecCtx = nullptr;
+    SwrContext* _swrCtx = nullptr;
+    AVFrame* _frame = nullptr;
+    AVPacket* _pkt = nullptr;
+    int _streamIndex = -1;
+    std::vector<float> _pending;
+    size_t _pendingOffset = 0;
+    bool _draining = false;
+
+    void open(const std::string& filename) {
+        AVDictionary* format_options = nullptr;
+        av_dict_set(&format_options, "scan_all_pmts", "1", AV_DICT_MATCH_CASE);
+        if (avformat_open_input(&_fmtCtx, filename.c_str(), nullptr, &format_options) != 0) {
+            av_dict_free(&format_options);
+            throw std::runtime_error("Could not open file: " + filename);
+        }
+        av_dict_free(&format_options);
+
+        if (avformat_find_stream_info(_fmtCtx, nullptr) < 0) {
+            throw std::runtime_error("Could not find stream information");
+        }
+
+        const AVCodec* codec = nullptr;
+        for (unsigned int i = 0; i < _fmtCtx->nb_streams; i++) {
+            const AVCodecParameters* codec_par = _fmtCtx->streams[i]->codecpar;
+            if (codec_par->codec_type == AVMEDIA_TYPE_AUDIO) {
+                _streamIndex = i;
+                codec = avcodec_find_decoder(codec_par->codec_id);
+                if (codec) break;
+            }
+        }
+        if (_streamIndex == -1 || !codec) {
+            throw std::runtime_error("Could not find audio stream or unsupported codec");
+        }
+
+        _codecCtx = avcodec_alloc_context3(codec);
+        if (!_codecCtx) {
+            throw std::runtime_error("Could not allocate codec context");
+        }
+        if (avcodec_parameters_to_context(_codecCtx, _fmtCtx->streams[_streamIndex]->codecpar) < 0) {
+            throw std::runtime_error("Could not copy codec parameters");
+        }
+
+        AVDictionary* decoder_options = nullptr;
+        av_dict_set(&decoder_options, "strict", "experimental", 0);
+        if (avcodec_open2(_codecCtx, codec, &decoder_options) < 0) {
+            av_dict_free(&decoder_options);
+            throw std::runtime_error("Could not open codec");
+        }
+        av_dict_free(&decoder_options);
+
+        if (swr_alloc_set_opts2(&_swrCtx,
+                                &_codecCtx->ch_layout, AV_SAMPLE_FMT_FLT, _codecCtx->sample_rate,
+                                &_codecCtx->ch_layout, _codecCtx->sample_fmt, _codecCtx->sample_rate,
+                                0, nullptr) < 0 || !_swrCtx || swr_init(_swrCtx) < 0) {
+            throw std::runtime_error("Could not initialize resampler");
+        }
+
+        _frame = av_frame_alloc();
+        if (!_frame) throw std::runtime_error("Could not allocate frame");
+        _pkt = av_packet_alloc();
+        if (!_pkt) throw std::runtime_error("Could not allocate packet");
+    }
+
+    void close() {
+        if (_pkt) av_packet_free(&_pkt);
+        if (_frame) av_frame_free(&_frame);
+        if (_swrCtx) swr_free(&_swrCtx);
+        if (_codecCtx) avcodec_free_context(&_codecCtx);
+        if (_fmtCtx) avformat_close_input(&_fmtCtx);
+    }
+
+    // Converts the next decoded frame into _pending; returns false at the end of the stream
+    bool decodeFrame() {
+        while (true) {
+            int ret = avcodec_receive_frame(_codecCtx, _frame);
+            if (ret == 0) {
+                int out_samples = swr_get_out_samples(_swrCtx, _frame->nb_samples);
+                if (out_samples <= 0) {
+                    out_samples = _frame->nb_samples;
+                }
+                _pending.resize(static_cast<size_t>(out_samples) * channels());
+                uint8_t* out_data[1] = {reinterpret_cast<uint8_t*>(_pending.data())};
+                const int converted = swr_convert(_swrCtx, out_data, out_samples,
+                                                  (const uint8_t**)_frame->data, _frame->nb_samples);
+                av_frame_unref(_frame);
+                if (converted < 0) {
+                    throw std::runtime_error("Error in audio conversion");
+                }
+                _pending.resize(static_cast<size_t>(converted) * channels());
+                _pendingOffset = 0;
+                return true;
+            }
+            if (ret == AVERROR_EOF || (ret == AVERROR(EAGAIN) && _draining)) {
+                return false;
+            }
+            if (ret != AVERROR(EAGAIN)) {
+                throw std::runtime_error("Error during audio decoding");
+            }
+
+            if (av_read_frame(_fmtCtx, _pkt) < 0) {
+                avcodec_send_packet(_codecCtx, nullptr);
+                _draining = true;
+                continue;
+            }
+            if (_pkt->stream_index == _streamIndex) {
+                avcodec_send_packet(_codecCtx, _pkt);
+            }
+            av_packet_unref(_pkt);
+        }
+    }
+};
+
+// Samples are decoded interleaved; the planar layout converts them once in read()
+template <typename Layout>
+class BasicDataAudio : public Data<BasicMetadataAudio<Layout>> {
+public:
+    using Metadata = BasicMetadataAudio<Layout>;
+
+    BasicDataAudio(const std::string& filename) {
+        this->_filename = filename;
         av_log_set_level(AV_LOG_QUIET);
     }
+
+    // Generated signals never touch disk: samples are produced in read() from the seed,
+    // noise differs between channels, tones and sweeps are the same on every channel
+    BasicDataAudio(AudioSignal signal, int sampleRate, int channels, double duration, unsigned int seed = 0)
+        : _generated(true), _signal(signal), _seed(seed), _signalRate(sampleRate), _signalChannels(channels), _duration(duration) {
+        if (sampleRate <= 0 || channels <= 0 || channels > std::numeric_limits<uint16_t>::max() || duration <= 0) {
+            throw std::invalid_argument("Invalid signal parameters");
+        }
+        if (static_cast<int>(signal) < static_cast<int>(AudioSignal::SineSweep) || static_cast<int>(signal) > static_cast<int>(AudioSignal::ImpulseTrain)) {
+            throw std::invalid_argument("Invalid audio signal");
+        }
+        static const char* names[] = {"sweep", "chirp", "multitone", "white", "pink", "impulses"};
+        std::ostringstream name;
+        name << names[static_cast<int>(signal)] << "_" << sampleRate << "_" << channels << "ch_" << duration << "s_" << seed;
+        this->_filename = name.str();
+    }
+
+    // Streaming mode: read() only probes the file and the tested function receives an
+    // AudioBuffer without data, its samples are reached through AudioBuffer::chunks()
+    BasicDataAudio(const std::string& filename, const AudioStreaming& streaming) : BasicDataAudio(filename) {
+        static_assert(!Layout::planar, "Streamed audio is delivered in interleaved chunks");
+        _streaming = true;
+        _chunkOptions = streaming;
+    }
     
-    ~DataAudio() override { 
+    ~BasicDataAudio() override { 
         clear(); 
         clear_copy();
     }
 
     void read() override {
-        if (!_filename.empty()) load();
+        if (!this->_filename.empty()) load();
     }
 
     void clear() override {
         _audioData.clear();
         _audioData.shrink_to_fit();
+        _planarData.reset();
+        _channelStride = 0;
         _sampleCount = 0;
         _sampleRate = 0;
         _channels = 0;
     }
 
-    MetadataAudio& copy() override {
+    Metadata& copy() override {
         clear_copy();
-        
-        float* copyData = new float[_audioData.size()];
-        std::copy(_audioData.begin(), _audioData.end(), copyData);
-        
-        AudioBuffer audioBuffer(copyData, _channels);
-        
-        _copy = std::make_tuple(audioBuffer, _sampleCount, _sampleRate, _channels);
-        return _copy;
+
+        if constexpr (Layout::planar) {
+            _copyBuffer.resize(_planarData.size());
+            parallelCopy(_copyBuffer.data(), _planarData.data(), _planarData.size());
+            PlanarAudioBuffer audioBuffer(reinterpret_cast<float*>(_copyBuffer.data()), _channels, _channelStride);
+            this->_copy = std::make_tuple(audioBuffer, _sampleCount, _sampleRate, _channels);
+        } else if (_streaming) {
+            this->_copy = std::make_tuple(AudioBuffer(nullptr, _channels, this), _sampleCount, _sampleRate, _channels);
+        } else {
+            float* copyData = new float[_audioData.size()];
+            std::copy(_audioData.begin(), _audioData.end(), copyData);
+            
+            AudioBuffer audioBuffer(copyData, _channels, this);
+            this->_copy = std::make_tuple(audioBuffer, _sampleCount, _sampleRate, _channels);
+        }
+        return this->_copy;
+    }
+
+    Metadata& restore() override {
+        float* data = std::get<0>(this->_copy).data();
+        if (!data) {
+            return copy();
+        }
+        if constexpr (Layout::planar) {
+            parallelCopy(data, _planarData.data(), _planarData.size());
+        } else {
+            parallelCopy(data, _audioData.data(), _audioData.size() * sizeof(float));
+        }
+        return this->_copy;
+    }
+
+    Metadata& share() override {
+        if constexpr (Layout::planar) {
+            PlanarAudioBuffer audioBuffer(reinterpret_cast<float*>(_planarData.data()), _channels, _channelStride);
+            this->_view = std::make_tuple(audioBuffer, _sampleCount, _sampleRate, _channels);
+        } else {
+            if (_streaming) {
+                return copy();
+            }
+            AudioBuffer audioBuffer(_audioData.data(), _channels, this);
+            this->_view = std::make_tuple(audioBuffer, _sampleCount, _sampleRate, _channels);
+        }
+        return this->_view;
     }
 
     void clear_copy() override {
-        auto buffer = std::get<0>(_copy);
-        if (buffer.data()) {
-            buffer.clear();
-            _copy = std::make_tuple(AudioBuffer(), 0, 0, 0);
+        if constexpr (Layout::planar) {
+            _copyBuffer.reset();
+            this->_copy = Metadata();
+        } else {
+            auto buffer = std::get<0>(this->_copy);
+            if (buffer.data()) {
+                buffer.clear();
+                this->_copy = std::make_tuple(AudioBuffer(), 0, 0, 0);
+            }
         }
     }
 
+    // Streamed audio is never materialized, so there is nothing to save
     const std::string save_copy(const std::string& dirname, int args_id, int thread_num = 0) const override {
+        if (_streaming) {
+            return "";
+        }
         try {
-            auto buffer = std::get<0>(_copy);
+            auto buffer = std::get<0>(this->_copy);
             if (buffer.data()) {
-                std::string filename = "proc" + proc_data_str(args_id, thread_num) + "_" + _filename + ".m4a";
+                std::string filename = "proc" + this->proc_data_str(args_id, thread_num) + "_" + this->_filename + ".m4a";
                 std::filesystem::path file_path = std::filesystem::path(dirname) / filename;
                 save(true, args_id, thread_num, file_path.string());
                 return filename;
@@ -103,6 +438,31 @@ public:
         }
     }
 
+    std::pair<std::string, std::function<void()>> detach_copy(const std::string& dirname, int args_id, int thread_num = 0) override {
+        if (_streaming) {
+            return {"", nullptr};
+        }
+        float* data = std::get<0>(this->_copy).data();
+        if (!data) {
+            throw std::runtime_error("Copy data not found");
+        }
+        std::string filename = "proc" + this->proc_data_str(args_id, thread_num) + "_" + this->_filename + ".m4a";
+        std::filesystem::path file_path = std::filesystem::path(dirname) / filename;
+
+        std::shared_ptr<const float> samples;
+        if constexpr (Layout::planar) {
+            auto buffer = std::make_shared<AlignedBuffer>(std::move(_copyBuffer));
+            samples = std::shared_ptr<const float>(buffer, reinterpret_cast<const float*>(buffer->data()));
+        } else {
+            samples = std::shared_ptr<const float>(data, std::default_delete<float[]>());
+        }
+        this->_copy = Metadata();
+
+        return {filename, [samples, file_path, sampleCount = _sampleCount, sampleRate = _sampleRate, channels = _channels, channelStride = _channelStride]() {
+            encode(file_path.string(), samples.get(), sampleCount, sampleRate, channels, channelStride);
+        }};
+    }
+
     const std::string title() const override {
         std::stringstream ss;
         ss << "Аудиофайл с частотой " << _sampleRate << " Гц, "
@@ -115,13 +475,154 @@ public:
         return std::string("audio");
     }
 
+    // Chunks of data, or of the decoded file in streaming mode, where data is ignored and a
+    // helper thread decodes up to poolChunks chunks ahead of the consumer. The stream keeps
+    // its own copy of the file name and sizes, so it does not depend on this object; only
+    // data must stay alive while the stream is in use
+    AudioChunkStream chunks(float* data) const {
+        const size_t chunkSamples = _chunkOptions.chunkSamples;
+        if (chunkSamples == 0) {
+            throw std::invalid_argument("Chunk size must be positive");
+        }
+        const int channels = _channels;
+
+        if (_streaming) {
+            return AudioChunkStream(std::numeric_limits<size_t>::max(), _chunkOptions.poolChunks, chunkSamples * channels * sizeof(float),
+                [file = this->_filename, chunkSamples, channels, decoder = std::unique_ptr<AudioStreamDecoder>()](size_t index, uint8_t* slot, AudioChunk& chunk) mutable {
+                    if (!decoder) {
+                        decoder = std::make_unique<AudioStreamDecoder>(file);
+                    }
+                    chunk.index = index;
+                    chunk.firstSample = index * chunkSamples;
+                    chunk.channels = channels;
+                    chunk.data = reinterpret_cast<float*>(slot);
+                    chunk.samples = decoder->read(chunk.data, chunkSamples);
+                    return chunk.samples > 0;
+                });
+        }
+
+        if (!data) {
+            throw std::runtime_error("Audio data not loaded");
+        }
+        const size_t sampleCount = _sampleCount;
+        return AudioChunkStream((sampleCount + chunkSamples - 1) / chunkSamples, _chunkOptions.poolChunks, 0,
+            [data, sampleCount, chunkSamples, channels](size_t index, uint8_t*, AudioChunk& chunk) {
+                chunk.index = index;
+                chunk.firstSample = index * chunkSamples;
+                chunk.samples = std::min(chunkSamples, sampleCount - chunk.firstSample);
+                chunk.channels = channels;
+                chunk.data = data + chunk.firstSample * channels;
+                return true;
+            });
+    }
+
 protected:
     std::vector<float> _audioData;
+    AlignedBuffer _planarData;
+    AlignedBuffer _copyBuffer;
+    size_t _channelStride = 0;
     size_t _sampleCount = 0;
     int _sampleRate = 0;
     int _channels = 0;
+    bool _streaming = false;
+    AudioStreaming _chunkOptions;
+    bool _generated = false;
+    AudioSignal _signal = AudioSignal::SineSweep;
+    unsigned int _seed = 0;
+    int _signalRate = 0;
+    int _signalChannels = 0;
+    double _duration = 0.0;
+
+    static uint64_t hash(uint64_t x) {
+        x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+        return x ^ (x >> 31);
+    }
+
+    // Uniform in [-1, 1), a pure function of its arguments
+    static double hashSigned(uint64_t seed, uint64_t a, uint64_t b) {
+        return (hash(seed ^ hash(a * 0x9E3779B97F4A7C15ULL + b)) >> 11) * (2.0 / 9007199254740992.0) - 1.0;
+    }
+
+    float signalSample(size_t index, size_t channel) const {
+        constexpr double pi = 3.14159265358979323846;
+        const double rate = _signalRate;
+        const double t = index / rate;
+        const double low = 20.0;
+        const double high = std::min(20000.0, 0.45 * rate);
+        const uint64_t seed = hash(_seed + 0x9E3779B97F4A7C15ULL * (channel + 1));
+
+        switch (_signal) {
+            case AudioSignal::SineSweep: {
+                const double rise = std::log(high / low);
+                return static_cast<float>(0.5 * std::sin(2 * pi * low * _duration / rise * (std::exp(t / _duration * rise) - 1)));
+            }
+            case AudioSignal::Chirp:
+                return static_cast<float>(0.5 * std::sin(2 * pi * (low * t + (high - low) * t * t / (2 * _duration))));
+            case AudioSignal::Multitone: {
+                const int tones = 8;
+                double value = 0.0;
+                for (int k = 0; k < tones; ++k) {
+                    const double frequency = 100.0 * std::pow(high / 100.0, double(k) / (tones - 1));
+                    const double phase = pi * (hashSigned(_seed, k, 0) + 1);
+                    value += std::sin(2 * pi * frequency * t + phase);
+                }
+                return static_cast<float>(0.8 * value / tones);
+            }
+            case AudioSignal::WhiteNoise:
+                return static_cast<float>(0.5 * hashSigned(seed, index, 0));
+            case AudioSignal::PinkNoise: {
+                // Row k holds a random value for 2^k samples, so any sample is computed without history
+                const int rows = 16;
+                double value = hashSigned(seed, index, 0);
+                for (int k = 1; k <= rows; ++k) {
+                    value += hashSigned(seed, index >> k, k);
+                }
+                return static_cast<float>(value / (rows + 1));
+            }
+            case AudioSignal::ImpulseTrain: {
+                const size_t period = std::max<size_t>(1, static_cast<size_t>(rate / 10));
+                return index % period == 0 ? 1.0f : 0.0f;
+            }
+        }
+        return 0.0f;  // unreachable, the constructor rejects unknown signals
+    }
+
+    // Samples are independent, so the result does not depend on the thread count
+    void generate() {
+        _sampleRate = _signalRate;
+        _channels = _signalChannels;
+        _sampleCount = static_cast<size_t>(std::llround(_duration * _signalRate));
+        const size_t channels = _channels;
+
+        if constexpr (Layout::planar) {
+            _channelStride = alignedSize(_sampleCount * sizeof(float)) / sizeof(float);
+            _planarData.resize(channels * _channelStride * sizeof(float));
+            float* planar = reinterpret_cast<float*>(_planarData.data());
+            #pragma omp parallel for collapse(2) schedule(static)
+            for (size_t c = 0; c < channels; ++c) {
+                for (size_t i = 0; i < _channelStride; ++i) {
+                    planar[c * _channelStride + i] = i < _sampleCount ? signalSample(i, c) : 0.0f;
+                }
+            }
+        } else {
+            _audioData.resize(_sampleCount * channels);
+            #pragma omp parallel for schedule(static)
+            for (size_t i = 0; i < _sampleCount; ++i) {
+                for (size_t c = 0; c < channels; ++c) {
+                    _audioData[i * channels + c] = signalSample(i, c);
+                }
+            }
+        }
+    }
 
     void save(bool saveCopy, int args_id, int thread_num, const std::string& filename) const override {
+        const float* srcData = saveCopy ? std::get<0>(this->_copy).data()
+                                        : Layout::planar ? reinterpret_cast<const float*>(_planarData.data()) : _audioData.data();
+        encode(filename, srcData, _sampleCount, _sampleRate, _channels, _channelStride);
+    }
+
+    static void encode(const std::string& filename, const float* srcData, size_t sampleCount, int sampleRate, int channels, size_t channelStride) {
         AVFormatContext* fmt_ctx = nullptr;
         AVCodecContext* codec_ctx = nullptr;
         SwrContext* swr_ctx = nullptr;
@@ -150,13 +651,13 @@ protected:
             }
 
             uint64_t channel_layout = 0;
-            for (int i = 0; i < _channels; ++i) {
+            for (int i = 0; i < channels; ++i) {
                 channel_layout |= 1ULL << i;
             }
             av_channel_layout_from_mask(&out_layout, channel_layout);
 
             codec_ctx->sample_fmt = AV_SAMPLE_FMT_FLTP;
-            codec_ctx->sample_rate = _sampleRate;
+            codec_ctx->sample_rate = sampleRate;
             av_channel_layout_copy(&codec_ctx->ch_layout, &out_layout);
             codec_ctx->bit_rate = 64000;
             codec_ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
@@ -187,8 +688,8 @@ protected:
             }
 
             if (swr_alloc_set_opts2(&swr_ctx,
-                                  &out_layout, AV_SAMPLE_FMT_FLTP, _sampleRate,
-                                  &out_layout, AV_SAMPLE_FMT_FLT, _sampleRate,
+                                  &out_layout, AV_SAMPLE_FMT_FLTP, sampleRate,
+                                  &out_layout, Layout::sampleFormat, sampleRate,
                                   0, nullptr) < 0 || !swr_ctx || swr_init(swr_ctx) < 0) {
                 throw std::runtime_error("Could not initialize resampler");
             }
@@ -213,25 +714,26 @@ protected:
 
             int64_t pts = 0;
             size_t samples_written = 0;
-            const float* srcData = saveCopy ? std::get<0>(_copy).data() : _audioData.data();
+            const int inputPlanes = Layout::planar ? channels : 1;
+            std::vector<const uint8_t*> in_data(std::max(inputPlanes, AV_NUM_DATA_POINTERS), nullptr);
 
-            while (samples_written < _sampleCount) {
+            while (samples_written < sampleCount) {
                 size_t samples_to_write = std::min(
                     static_cast<size_t>(frame->nb_samples), 
-                    _sampleCount - samples_written
+                    sampleCount - samples_written
                 );
 
                 if (av_frame_make_writable(frame) < 0) {
                     throw std::runtime_error("Frame is not writable");
                 }
 
-                const uint8_t* in_data[AV_NUM_DATA_POINTERS] = {
-                    reinterpret_cast<const uint8_t*>(srcData + samples_written * _channels),
-                    nullptr
-                };
+                for (int plane = 0; plane < inputPlanes; ++plane) {
+                    in_data[plane] = reinterpret_cast<const uint8_t*>(Layout::planar ? srcData + plane * channelStride + samples_written
+                                                                                     : srcData + samples_written * channels);
+                }
                 
                 if (swr_convert(swr_ctx, frame->data, samples_to_write,
-                               in_data, samples_to_write) < 0) {
+                               in_data.data(), samples_to_write) < 0) {
                     throw std::runtime_error("Error in audio conversion");
                 }
 
@@ -291,139 +793,110 @@ protected:
     }
 
     void load() override {
-        AVFormatContext* fmt_ctx = nullptr;
-        AVCodecContext* codec_ctx = nullptr;
-        SwrContext* swr_ctx = nullptr;
-        AVFrame* frame = nullptr;
-        AVPacket* pkt = nullptr;
-        AVChannelLayout in_layout, out_layout;
-    
-        try {
-            AVDictionary* format_options = nullptr;
-            av_dict_set(&format_options, "scan_all_pmts", "1", AV_DICT_MATCH_CASE);
-            
-            if (avformat_open_input(&fmt_ctx, _filename.c_str(), nullptr, &format_options) != 0) {
-                av_dict_free(&format_options);
-                throw std::runtime_error("Could not open file: " + _filename);
-            }
-            av_dict_free(&format_options);
-    
-            if (avformat_find_stream_info(fmt_ctx, nullptr) < 0) {
-                throw std::runtime_error("Could not find stream information");
-            }
-    
-            int audio_stream_idx = -1;
-            const AVCodec* codec = nullptr;
-            AVCodecParameters* codec_par = nullptr;
-            
-            for (unsigned int i = 0; i < fmt_ctx->nb_streams; i++) {
-                codec_par = fmt_ctx->streams[i]->codecpar;
-                if (codec_par->codec_type == AVMEDIA_TYPE_AUDIO) {
-                    audio_stream_idx = i;
-                    codec = avcodec_find_decoder(codec_par->codec_id);
-                    if (codec) break;
-                }
-            }
-            
-            if (audio_stream_idx == -1 || !codec) {
-                throw std::runtime_error("Could not find audio stream or unsupported codec");
-            }
-    
-            codec_ctx = avcodec_alloc_context3(codec);
-            if (!codec_ctx) {
-                throw std::runtime_error("Could not allocate codec context");
-            }
-    
-            if (avcodec_parameters_to_context(codec_ctx, codec_par) < 0) {
-                throw std::runtime_error("Could not copy codec parameters");
-            }
-    
-            AVDictionary* decoder_options = nullptr;
-            av_dict_set(&decoder_options, "strict", "experimental", 0);
-            
-            if (avcodec_open2(codec_ctx, codec, &decoder_options) < 0) {
-                av_dict_free(&decoder_options);
-                throw std::runtime_error("Could not open codec");
+        if (_generated) {
+            generate();
+            return;
+        }
+
+        if (!_streaming && loadCached()) {
+            return;
+        }
+
+        AudioStreamDecoder decoder(this->_filename);
+        _sampleRate = decoder.sampleRate();
+        _channels = decoder.channels();
+        if (_streaming) {
+            _sampleCount = decoder.countSamples();
+            return;
+        }
+
+        const size_t block = 1 << 16;
+        _audioData.reserve(decoder.estimatedSamples() * _channels);
+        size_t decoded = 0;
+        do {
+            const size_t previous = _audioData.size();
+            _audioData.resize(previous + block * _channels);
+            decoded = decoder.read(_audioData.data() + previous, block);
+            _audioData.resize(previous + decoded * _channels);
+        } while (decoded == block);
+
+        _sampleCount = _channels > 0 ? _audioData.size() / _channels : 0;
+
+        if constexpr (Layout::planar) {
+            toPlanar();
+            MediaCache::store(this->_filename, cacheFormat(), _planarData.data(), _planarData.size(), {static_cast<uint64_t>(_sampleRate), static_cast<uint64_t>(_channels), _sampleCount, _channelStride});
+        } else {
+            MediaCache::store(this->_filename, cacheFormat(), _audioData.data(), _audioData.size() * sizeof(float), {static_cast<uint64_t>(_sampleRate), static_cast<uint64_t>(_channels), _sampleCount, 0});
+        }
+    }
+
+    static std::string cacheFormat() {
+        return Layout::planar ? "audio:f32:planar" : "audio:f32:interleaved";
+    }
+
+    // Planar samples are mapped in place, interleaved ones are copied out of the mapping
+    bool loadCached() {
+        AlignedBuffer cached;
+        std::vector<uint64_t> params;
+        if (!MediaCache::load(this->_filename, cacheFormat(), cached, params) || params.size() != 4) {
+            return false;
+        }
+        const size_t channels = params[1];
+        const size_t samples = params[2];
+        const size_t stride = params[3];
+        if constexpr (Layout::planar) {
+            if (cached.size() != channels * stride * sizeof(float)) {
+                return false;
             }
-            av_dict_free(&decoder_options);
-    
-            av_channel_layout_copy(&in_layout, &codec_ctx->ch_layout);
-            _sampleRate = codec_ctx->sample_rate;
-            _channels = in_layout.nb_channels;
-    
-            av_channel_layout_copy(&out_layout, &in_layout);
-    
-            frame = av_frame_alloc();
-            if (!frame) throw std::runtime_error("Could not allocate frame");
-            
-            pkt = av_packet_alloc();
-            if (!pkt) throw std::runtime_error("Could not allocate packet");
-    
-            if (swr_alloc_set_opts2(&swr_ctx,
-                                  &out_layout, AV_SAMPLE_FMT_FLT, _sampleRate,
-                                  &in_layout, codec_ctx->sample_fmt, _sampleRate,
-                                  0, nullptr) < 0 || !swr_ctx || swr_init(swr_ctx) < 0) {
-                throw std::runtime_error("Could not initialize resampler");
+            _planarData = std::move(cached);
+            _channelStride = stride;
+        } else {
+            if (cached.size() != channels * samples * sizeof(float)) {
+                return false;
             }
-    
-            _audioData.reserve(fmt_ctx->duration * _sampleRate / AV_TIME_BASE * _channels);
-    
-            while (av_read_frame(fmt_ctx, pkt) >= 0) {
-                if (pkt->stream_index == audio_stream_idx) {
-                    if (avcodec_send_packet(codec_ctx, pkt) == 0) {
-                        while (avcodec_receive_frame(codec_ctx, frame) == 0) {
-                            int out_samples = swr_get_out_samples(swr_ctx, frame->nb_samples);
-                            if (out_samples <= 0) {
-                                out_samples = frame->nb_samples;
-                            }
-                            
-                            uint8_t* out_data[AV_NUM_DATA_POINTERS] = {nullptr};
-                            int linesize;
-                            if (av_samples_alloc(out_data, &linesize, out_layout.nb_channels,
-                                              out_samples, AV_SAMPLE_FMT_FLT, 0) < 0) {
-                                throw std::runtime_error("Could not allocate samples");
-                            }
-                            
-                            int converted = swr_convert(swr_ctx, out_data, out_samples,
-                                                      (const uint8_t**)frame->data, frame->nb_samples);
-                            
-                            if (converted > 0) {
-                                size_t prev_size = _audioData.size();
-                                _audioData.resize(prev_size + converted * _channels);
-                                
-                                memcpy(_audioData.data() + prev_size, 
-                                       out_data[0], 
-                                       converted * _channels * sizeof(float));
-                            }
-                            
-                            if (out_data[0]) av_freep(&out_data[0]);
-                        }
-                    }
+            _audioData.resize(channels * samples);
+            parallelCopy(_audioData.data(), cached.data(), cached.size());
+        }
+        _sampleRate = static_cast<int>(params[0]);
+        _channels = static_cast<int>(channels);
+        _sampleCount = samples;
+        return true;
+    }
+
+    // Transposes the decoded samples into aligned, zero-padded channel arrays
+    void toPlanar() {
+        _channelStride = alignedSize(_sampleCount * sizeof(float)) / sizeof(float);
+        _planarData.resize(_channels * _channelStride * sizeof(float));
+        float* planar = reinterpret_cast<float*>(_planarData.data());
+        const float* interleaved = _audioData.data();
+        const size_t channels = _channels;
+        const size_t block = 4096;
+        const size_t blocks = (_channelStride + block - 1) / block;
+
+        #pragma omp parallel for collapse(2) schedule(static)
+        for (size_t c = 0; c < channels; ++c) {
+            for (size_t b = 0; b < blocks; ++b) {
+                float* out = planar + c * _channelStride;
+                const size_t end = std::min((b + 1) * block, _channelStride);
+                for (size_t i = b * block; i < end; ++i) {
+                    out[i] = i < _sampleCount ? interleaved[i * channels + c] : 0.0f;
                 }
-                av_packet_unref(pkt);
             }
-    
-            _sampleCount = _audioData.size() / _channels;
-            av_channel_layout_uninit(&in_layout);
-            av_channel_layout_uninit(&out_layout);
-        }
-        catch (...) {
-            av_channel_layout_uninit(&in_layout);
-            av_channel_layout_uninit(&out_layout);
-            if (pkt) av_packet_free(&pkt);
-            if (frame) av_frame_free(&frame);
-            if (swr_ctx) swr_free(&swr_ctx);
-            if (codec_ctx) avcodec_free_context(&codec_ctx);
-            if (fmt_ctx) avformat_close_input(&fmt_ctx);
-            throw;
         }
-    
-        if (pkt) av_packet_free(&pkt);
-        if (frame) av_frame_free(&frame);
-        if (swr_ctx) swr_free(&swr_ctx);
-        if (codec_ctx) avcodec_free_context(&codec_ctx);
-        if (fmt_ctx) avformat_close_input(&fmt_ctx);
+
+        _audioData.clear();
+        _audioData.shrink_to_fit();
     }
 };
 
+using DataAudio = BasicDataAudio<InterleavedAudioLayout>;
+using DataAudioPlanar = BasicDataAudio<PlanarAudioLayout>;
+
+inline AudioChunkStream AudioBuffer::chunks() const {
+    if (!_source) {
+        throw std::runtime_error("Audio buffer has no source");
+    }
+    return _source->chunks(_data);
+}
+
 #endif
\ No newline at end of file
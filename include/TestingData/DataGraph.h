@@ -0,0 +1,323 @@
+#ifndef DATA_GRAPH_H
+#define DATA_GRAPH_H
+
+#include "Data.h"
+#include <filesystem>
+#include <limits>
+#include <numeric>
+#include <string>
+#include <tuple>
+#include <type_traits>
+
+template <typename T>
+using MetadataGraph = std::tuple<
+    size_t*,    // Row offsets (vertices + 1)
+    T*,         // Adjacency
+    size_t*,    // Reverse row offsets, nullptr without reverse graph
+    T*,         // Reverse adjacency, nullptr without reverse graph
+    size_t,     // Vertex count
+    size_t      // Edge count
+>;
+
+enum class GraphModel {
+    RMAT,
+    Kronecker,
+    ErdosRenyi
+};
+
+enum class GraphFileFormat {
+    Native,
+    EdgeList
+};
+
+template <typename T>
+class DataGraph : public Data<MetadataGraph<T>> {
+    static_assert(std::is_integral_v<T> && std::is_unsigned_v<T>, "Vertex type must be an unsigned integer");
+public:
+    DataGraph(const std::string &filename, bool withReverse = false, GraphFileFormat format = GraphFileFormat::Native)
+        : _withReverse(withReverse), _format(format) {
+        this->_filename = filename;
+    }
+
+    // The same seed reproduces the same graph regardless of the thread count
+    DataGraph(GraphModel model, size_t scale, size_t edgeFactor, bool withReverse = false, const char* file_path = "", unsigned int seed = 0)
+        : _withReverse(withReverse), _format(GraphFileFormat::Native) {
+        if (scale >= static_cast<size_t>(std::numeric_limits<T>::digits)) {
+            throw std::overflow_error("Graph scale exceeds vertex type range");
+        }
+        _vertices = size_t(1) << scale;
+        if (edgeFactor > std::numeric_limits<size_t>::max() / 2 / _vertices) {
+            throw std::overflow_error("Graph edge count exceeds size range");
+        }
+
+        std::vector<T> edges;
+        if (model == GraphModel::RMAT || model == GraphModel::Kronecker) {
+            generateRMAT(scale, _vertices * edgeFactor, seed, edges);
+            if (model == GraphModel::Kronecker) {
+                permuteVertices(seed, edges);
+            }
+        } else if (model == GraphModel::ErdosRenyi) {
+            generateErdosRenyi(_vertices * edgeFactor, seed, edges);
+        } else {
+            throw std::invalid_argument("Invalid graph model");
+        }
+        buildCSR(edges, false, _offsets, _columns);
+
+        std::string filename = std::string(file_path);
+        if (filename.empty()) {
+            this->_filename = this->getCurrentDateTime() + ".graph";
+        } else {
+            this->_filename = filename;
+        }
+        save(false, 0, 0, this->_filename);
+
+        clear();
+    }
+
+    void read() override {
+        if (!this->_filename.empty()) {
+            load();
+        }
+    }
+
+    void clear() override {
+        _offsets.clear();
+        _offsets.shrink_to_fit();
+        _columns.clear();
+        _columns.shrink_to_fit();
+        _reverseOffsets.clear();
+        _reverseOffsets.shrink_to_fit();
+        _reverseColumns.clear();
+        _reverseColumns.shrink_to_fit();
+    }
+
+    MetadataGraph<T>& copy() override {
+        clear_copy();
+
+        size_t* offsets = new size_t[_offsets.size()];
+        T* columns = new T[_columns.size()];
+        std::copy(_offsets.begin(), _offsets.end(), offsets);
+        std::copy(_columns.begin(), _columns.end(), columns);
+
+        size_t* reverseOffsets = nullptr;
+        T* reverseColumns = nullptr;
+        if (_withReverse) {
+            reverseOffsets = new size_t[_reverseOffsets.size()];
+            reverseColumns = new T[_reverseColumns.size()];
+            std::copy(_reverseOffsets.begin(), _reverseOffsets.end(), reverseOffsets);
+            std::copy(_reverseColumns.begin(), _reverseColumns.end(), reverseColumns);
+        }
+
+        this->_copy = std::make_tuple(offsets, columns, reverseOffsets, reverseColumns, _vertices, _columns.size());
+        return this->_copy;
+    }
+
+    MetadataGraph<T>& restore() override {
+        if (!std::get<0>(this->_copy)) {
+            return copy();
+        }
+        parallelCopy(std::get<0>(this->_copy), _offsets.data(), _offsets.size() * sizeof(size_t));
+        parallelCopy(std::get<1>(this->_copy), _columns.data(), _columns.size() * sizeof(T));
+        if (_withReverse) {
+            parallelCopy(std::get<2>(this->_copy), _reverseOffsets.data(), _reverseOffsets.size() * sizeof(size_t));
+            parallelCopy(std::get<3>(this->_copy), _reverseColumns.data(), _reverseColumns.size() * sizeof(T));
+        }
+        return this->_copy;
+    }
+
+    MetadataGraph<T>& share() override {
+        this->_view = std::make_tuple(_offsets.data(), _columns.data(), _withReverse ? _reverseOffsets.data() : nullptr,
+                                      _withReverse ? _reverseColumns.data() : nullptr, _vertices, _columns.size());
+        return this->_view;
+    }
+
+    void clear_copy() override {
+        delete[] std::get<0>(this->_copy);
+        delete[] std::get<1>(this->_copy);
+        delete[] std::get<2>(this->_copy);
+        delete[] std::get<3>(this->_copy);
+        this->_copy = MetadataGraph<T>();
+    }
+
+    const std::string save_copy(const std::string& dirname, int args_id, int thread_num) const override {
+        if (std::get<0>(this->_copy)) {
+            std::string filename = "proc" + this->proc_data_str(args_id, thread_num) + "_" + std::filesystem::path(this->_filename).filename().string();
+            std::filesystem::path file_path = std::filesystem::path(dirname) / filename;
+            save(true, args_id, thread_num, file_path);
+            return filename;
+        }
+        throw std::runtime_error("Copy data not found");
+    }
+
+    const std::string title() const override {
+        return "Граф с количеством вершин: " + std::to_string(_vertices) + " и рёбер: " + std::to_string(_columns.size());
+    }
+
+    const std::string type() const override {
+        return std::string("graph");
+    }
+
+private:
+    static constexpr double rmatA = 0.57;
+    static constexpr double rmatB = 0.19;
+    static constexpr double rmatC = 0.19;
+    static constexpr size_t generateBlock = 1 << 16;
+
+    std::vector<size_t> _offsets;
+    std::vector<T> _columns;
+    std::vector<size_t> _reverseOffsets;
+    std::vector<T> _reverseColumns;
+    size_t _vertices = 0;
+    bool _withReverse;
+    GraphFileFormat _format;
+
+    void generateRMAT(size_t scale, size_t edgeCount, uint64_t seed, std::vector<T>& edges) const {
+        edges.resize(2 * edgeCount);
+        const size_t blocks = (edgeCount + generateBlock - 1) / generateBlock;
+
+        #pragma omp parallel for schedule(static)
+        for (size_t block = 0; block < blocks; ++block) {
+            std::mt19937_64 gen(seed * 0x9E3779B97F4A7C15ULL + block);
+            std::uniform_real_distribution<double> dis(0.0, 1.0);
+            const size_t end = std::min(edgeCount, (block + 1) * generateBlock);
+            for (size_t e = block * generateBlock; e < end; ++e) {
+                T src = 0, dst = 0;
+                for (size_t bit = 0; bit < scale; ++bit) {
+                    double r = dis(gen);
+                    if (r < rmatA) {
+                        continue;
+                    } else if (r < rmatA + rmatB) {
+                        dst |= T(1) << bit;
+                    } else if (r < rmatA + rmatB + rmatC) {
+                        src |= T(1) << bit;
+                    } else {
+                        src |= T(1) << bit;
+                        dst |= T(1) << bit;
+                    }
+                }
+                edges[2 * e] = src;
+                edges[2 * e + 1] = dst;
+            }
+        }
+    }
+
+    void generateErdosRenyi(size_t edgeCount, uint64_t seed, std::vector<T>& edges) const {
+        edges.resize(2 * edgeCount);
+        const size_t blocks = (edgeCount + generateBlock - 1) / generateBlock;
+
+        #pragma omp parallel for schedule(static)
+        for (size_t block = 0; block < blocks; ++block) {
+            std::mt19937_64 gen(seed * 0x9E3779B97F4A7C15ULL + block);
+            std::uniform_int_distribution<size_t> dis(0, _vertices - 1);
+            const size_t end = std::min(edgeCount, (block + 1) * generateBlock);
+            for (size_t e = block * generateBlock; e < end; ++e) {
+                edges[2 * e] = static_cast<T>(dis(gen));
+                edges[2 * e + 1] = static_cast<T>(dis(gen));
+            }
+        }
+    }
+
+    void permuteVertices(uint64_t seed, std::vector<T>& edges) const {
+        std::vector<T> permutation(_vertices);
+        std::iota(permutation.begin(), permutation.end(), T(0));
+        std::shuffle(permutation.begin(), permutation.end(), std::mt19937_64(~seed));
+
+        #pragma omp parallel for schedule(static)
+        for (size_t i = 0; i < edges.size(); ++i) {
+            edges[i] = permutation[edges[i]];
+        }
+    }
+
+    void buildCSR(const std::vector<T>& edges, bool reverse, std::vector<size_t>& offsets, std::vector<T>& columns) const {
+        const size_t edgeCount = edges.size() / 2;
+        const size_t from = reverse ? 1 : 0;
+        const size_t to = reverse ? 0 : 1;
+
+        offsets.assign(_vertices + 1, 0);
+        #pragma omp parallel for schedule(static)
+        for (size_t e = 0; e < edgeCount; ++e) {
+            #pragma omp atomic
+            offsets[edges[2 * e + from] + 1]++;
+        }
+        std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+
+        columns.resize(edgeCount);
+        std::vector<size_t> position(offsets.begin(), offsets.end() - 1);
+        #pragma omp parallel for schedule(static)
+        for (size_t e = 0; e < edgeCount; ++e) {
+            size_t slot;
+            #pragma omp atomic capture
+            slot = position[edges[2 * e + from]]++;
+            columns[slot] = edges[2 * e + to];
+        }
+
+        #pragma omp parallel for schedule(dynamic, 1024)
+        for (size_t v = 0; v < _vertices; ++v) {
+            std::sort(columns.begin() + offsets[v], columns.begin() + offsets[v + 1]);
+        }
+    }
+
+    void save(bool saveCopy, int args_id, int thread_num, const std::string& filename) const override {
+        const size_t* offsets = saveCopy ? std::get<0>(this->_copy) : _offsets.data();
+        const T* columns = saveCopy ? std::get<1>(this->_copy) : _columns.data();
+
+        std::ofstream file(filename, std::ios::binary);
+        if (!file) throw std::runtime_error("Cannot open file");
+
+        const uint64_t type_size = sizeof(T);
+        const uint64_t vertices = _vertices;
+        const uint64_t edges = _columns.size();
+        file.write(reinterpret_cast<const char*>(&type_size), sizeof(type_size));
+        file.write(reinterpret_cast<const char*>(&vertices), sizeof(vertices));
+        file.write(reinterpret_cast<const char*>(&edges), sizeof(edges));
+
+        std::vector<T> edgeList(2 * edges);
+        #pragma omp parallel for schedule(dynamic, 1024)
+        for (size_t v = 0; v < _vertices; ++v) {
+            for (size_t e = offsets[v]; e < offsets[v + 1]; ++e) {
+                edgeList[2 * e] = static_cast<T>(v);
+                edgeList[2 * e + 1] = columns[e];
+            }
+        }
+        file.write(reinterpret_cast<const char*>(edgeList.data()), edgeList.size() * sizeof(T));
+    }
+
+    void load() override {
+        std::ifstream file(this->_filename, std::ios::binary);
+        if (!file) throw std::runtime_error("Cannot open file");
+
+        std::vector<T> edges;
+        if (_format == GraphFileFormat::Native) {
+            uint64_t type_size, vertices, edgeCount;
+            file.read(reinterpret_cast<char*>(&type_size), sizeof(type_size));
+            file.read(reinterpret_cast<char*>(&vertices), sizeof(vertices));
+            file.read(reinterpret_cast<char*>(&edgeCount), sizeof(edgeCount));
+            if (type_size != sizeof(T)) throw std::runtime_error("Vertex type size mismatch");
+            _vertices = vertices;
+            edges.resize(2 * edgeCount);
+        } else {
+            const auto fileSize = std::filesystem::file_size(this->_filename);
+            edges.resize(fileSize / sizeof(T) / 2 * 2);
+        }
+        file.read(reinterpret_cast<char*>(edges.data()), edges.size() * sizeof(T));
+        if (!file) throw std::runtime_error("Unexpected end of graph file");
+
+        T maxVertex = 0;
+        #pragma omp parallel for reduction(max:maxVertex) schedule(static)
+        for (size_t i = 0; i < edges.size(); ++i) {
+            maxVertex = std::max(maxVertex, edges[i]);
+        }
+        if (_format == GraphFileFormat::EdgeList) {
+            _vertices = edges.empty() ? 0 : size_t(maxVertex) + 1;
+        } else if (!edges.empty() && size_t(maxVertex) >= _vertices) {
+            throw std::runtime_error("Invalid vertex index in graph file");
+        }
+
+        buildCSR(edges, false, _offsets, _columns);
+        if (_withReverse) {
+            buildCSR(edges, true, _reverseOffsets, _reverseColumns);
+        }
+    }
+};
+
+#endif
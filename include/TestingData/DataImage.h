@@ -1,10 +1,17 @@
 #ifndef DATA_IMAGE_H
 #define DATA_IMAGE_H
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <functional>
 #include <iostream>
+#include <limits>
+#include <memory>
 #include <stdexcept>
 #include <string>
 #include <tuple>
+#include <type_traits>
 #include <variant>
 extern "C" {
 #include <libavcodec/avcodec.h>
@@ -17,6 +24,7 @@ extern "C" {
 }
 
 #include "Data.h"
+#include "MediaCache.h"
 
 struct RGBImage {
     uint8_t R;
@@ -26,368 +34,684 @@ struct RGBImage {
     RGBImage(uint8_t r = 0, uint8_t g = 0, uint8_t b = 0) : R(r), G(g), B(b) {}
 };
 
+static_assert(sizeof(RGBImage) == 3, "RGBImage must map onto packed RGB24 rows");
+
 using MetadataImage = std::tuple<RGBImage**, size_t, size_t>;
 
-class DataImage : public Data<MetadataImage> {
-public:
-    DataImage(const std::string& filename) {
-        _filename = filename;
-    }
+// Pixels, height, width, row stride in elements
+template <typename T>
+using MetadataImageBuffer = std::tuple<T*, size_t, size_t, size_t>;
 
-    void read() override {
-        if (!this->_filename.empty()) {
-            load();
+// R, G and B planes, height, width, row stride in elements
+template <typename T>
+using MetadataImagePlanes = std::tuple<T*, T*, T*, size_t, size_t, size_t>;
+
+using MetadataImagePacked = MetadataImageBuffer<uint8_t>;
+using MetadataImageRGBA = MetadataImageBuffer<uint8_t>;
+using MetadataImageGray8 = MetadataImageBuffer<uint8_t>;
+using MetadataImageGray16 = MetadataImageBuffer<uint16_t>;
+using MetadataImageRGB48 = MetadataImageBuffer<uint16_t>;
+using MetadataImagePlanar = MetadataImagePlanes<uint8_t>;
+using MetadataImagePlanarFloat = MetadataImagePlanes<float>;
+
+// Layouts describe how decoded pixels are stored and handed to the tested function.
+// Planes are kept in metadata order; swsPlanes maps swscale plane i to a stored plane.
+// 16-bit and float layouts convert with accurate rounding so no precision is lost.
+struct ImageRowsLayout {
+    using Metadata = MetadataImage;
+    using Element = uint8_t;
+    static constexpr AVPixelFormat format = AV_PIX_FMT_RGB24;
+    static constexpr AVPixelFormat saveFormat = AV_PIX_FMT_RGB24;
+    static constexpr size_t planes = 1;
+    static constexpr size_t pixelElements = 3;
+    static constexpr size_t swsPlanes[planes] = {0};
+    static constexpr int swsFlags = SWS_BILINEAR;
+
+    static Metadata metadata(Element* const* data, size_t height, size_t width, size_t stride) {
+        RGBImage** rows = new RGBImage*[height];
+        for (size_t y = 0; y < height; ++y) {
+            rows[y] = reinterpret_cast<RGBImage*>(data[0] + y * stride);
         }
+        return std::make_tuple(rows, height, width);
     }
 
-    void clear() override {
-        _data.clear();
-        _data.shrink_to_fit();
+    static void release(Metadata& metadata) {
+        delete[] std::get<0>(metadata);
     }
+};
 
-    MetadataImage& copy() override {
-        clear_copy();
+template <typename T, AVPixelFormat Format, AVPixelFormat SaveFormat, size_t PixelElements>
+struct PackedImageLayout {
+    using Metadata = MetadataImageBuffer<T>;
+    using Element = T;
+    static constexpr AVPixelFormat format = Format;
+    static constexpr AVPixelFormat saveFormat = SaveFormat;
+    static constexpr size_t planes = 1;
+    static constexpr size_t pixelElements = PixelElements;
+    static constexpr size_t swsPlanes[planes] = {0};
+    static constexpr int swsFlags = sizeof(T) > 1 ? SWS_BILINEAR | SWS_ACCURATE_RND : SWS_BILINEAR;
 
-        RGBImage** copy = new RGBImage*[_height];
-        for(size_t y = 0; y < _height; ++y) {
-            copy[y] = new RGBImage[_width];
-            for(size_t x = 0; x < _width; ++x) {
-                int index = (y * _width + x) * 3;
-                copy[y][x].R = _data[index];
-                copy[y][x].G = _data[index + 1];
-                copy[y][x].B = _data[index + 2];
-            }
-        }
-        _copy = std::make_tuple(copy, _height, _width);
-        return _copy;
+    static Metadata metadata(Element* const* data, size_t height, size_t width, size_t stride) {
+        return std::make_tuple(data[0], height, width, stride);
     }
 
-    void clear_copy() override {
-        try {
-            auto data = std::get<0>(_copy);
-            if (data) {
-                for (size_t y = 0; y < _height; y++) {
-                    delete[] data[y];
-                }
-                delete[] data;
-                data = nullptr;
-            }
-        } catch (const std::bad_variant_access& e) {
-            return;
-        }
-    }
+    static void release(Metadata&) {}
+};
 
-    const std::string save_copy(const std::string& dirname, int args_id, int thread_num) const override {
-        try {
-            auto data = std::get<0>(_copy);
-            if (data) {
-                std::string filename = "proc" + proc_data_str(args_id, thread_num) + "_" + _filename + ".png";
-                std::filesystem::path file_path = std::filesystem::path(dirname) / filename;
-                save(true, args_id, thread_num, file_path);
-                return filename;
-            } else {
-                throw std::runtime_error("Copy data not found");
-            }
-        } catch (const std::bad_variant_access& e) {
-            throw std::runtime_error("Copy data not found");
-        }
+template <typename T, AVPixelFormat Format, AVPixelFormat SaveFormat>
+struct PlanarImageLayout {
+    using Metadata = MetadataImagePlanes<T>;
+    using Element = T;
+    static constexpr AVPixelFormat format = Format;
+    static constexpr AVPixelFormat saveFormat = SaveFormat;
+    static constexpr size_t planes = 3;
+    static constexpr size_t pixelElements = 1;
+    static constexpr size_t swsPlanes[planes] = {1, 2, 0};
+    static constexpr int swsFlags = sizeof(T) > 1 ? SWS_BILINEAR | SWS_ACCURATE_RND : SWS_BILINEAR;
+
+    static Metadata metadata(Element* const* data, size_t height, size_t width, size_t stride) {
+        return std::make_tuple(data[0], data[1], data[2], height, width, stride);
     }
 
-    const std::string title() const override {
-        return "Изображение " + std::to_string(_width) + " на " + std::to_string(_height) + " пикселей.";
+    static void release(Metadata&) {}
+};
+
+// 16-bit and float layouts are written back as 16-bit PNG, the deepest format the encoder takes
+using PackedRGBLayout = PackedImageLayout<uint8_t, AV_PIX_FMT_RGB24, AV_PIX_FMT_RGB24, 3>;
+using RGBALayout = PackedImageLayout<uint8_t, AV_PIX_FMT_RGBA, AV_PIX_FMT_RGBA, 4>;
+using Gray8Layout = PackedImageLayout<uint8_t, AV_PIX_FMT_GRAY8, AV_PIX_FMT_GRAY8, 1>;
+using Gray16Layout = PackedImageLayout<uint16_t, AV_PIX_FMT_GRAY16, AV_PIX_FMT_GRAY16BE, 1>;
+using RGB48Layout = PackedImageLayout<uint16_t, AV_PIX_FMT_RGB48, AV_PIX_FMT_RGB48BE, 3>;
+using PlanarRGBLayout = PlanarImageLayout<uint8_t, AV_PIX_FMT_GBRP, AV_PIX_FMT_RGB24>;
+using PlanarFloatLayout = PlanarImageLayout<float, AV_PIX_FMT_GBRPF32, AV_PIX_FMT_RGB48BE>;
+
+// Decodes the first frame of image files. Codec, scaler, frame and packet are kept
+// between files, so a worker thread can reuse one decoder for a whole image set.
+class ImageDecoder {
+public:
+    ImageDecoder() = default;
+    ImageDecoder(const ImageDecoder&) = delete;
+    ImageDecoder& operator=(const ImageDecoder&) = delete;
+
+    ~ImageDecoder() {
+        av_packet_free(&_packet);
+        av_frame_free(&_frame);
+        avcodec_free_context(&_codecContext);
+        sws_freeContext(_swsContext);
     }
 
-    const std::string type() const override {
-        return std::string("image");
+    // Reads only the container header
+    void probe(const std::string& filename, size_t& width, size_t& height) {
+        int streamIndex = -1;
+        AVFormatContext* formatContext = open(filename, streamIndex);
+        width = formatContext->streams[streamIndex]->codecpar->width;
+        height = formatContext->streams[streamIndex]->codecpar->height;
+        avformat_close_input(&formatContext);
     }
 
-private:
-    std::vector<uint8_t> _data;
-    size_t _width = 0;
-    size_t _height = 0;
+    // The returned frame stays valid until the next decode
+    const AVFrame* decode(const std::string& filename) {
+        int streamIndex = -1;
+        AVFormatContext* formatContext = open(filename, streamIndex);
 
-    void load() override {
-        AVFormatContext* formatContext = nullptr;
-        AVCodecContext* codecContext = nullptr;
-        AVFrame* frame = nullptr;
-        SwsContext* swsContext = nullptr;
-        AVPacket* packet = nullptr;
-        
         try {
-            if (avformat_open_input(&formatContext, _filename.c_str(), nullptr, nullptr) != 0) {
-                throw std::runtime_error("Could not open file: " + _filename);
-            }
-        
-            if (avformat_find_stream_info(formatContext, nullptr) < 0) {
-                throw std::runtime_error("Could not find stream information");
-            }
-        
-            int videoStreamIndex = -1;
-            for (size_t i = 0; i < formatContext->nb_streams; i++) {
-                if (formatContext->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
-                    videoStreamIndex = i;
-                    break;
+            openCodec(formatContext->streams[streamIndex]->codecpar);
+
+            bool decoded = false;
+            while (!decoded && av_read_frame(formatContext, _packet) >= 0) {
+                if (_packet->stream_index == streamIndex && avcodec_send_packet(_codecContext, _packet) == 0) {
+                    decoded = avcodec_receive_frame(_codecContext, _frame) == 0;
                 }
+                av_packet_unref(_packet);
             }
-            if (videoStreamIndex == -1) {
-                throw std::runtime_error("Could not find video stream");
-            }
-        
-            AVCodecParameters* codecParameters = formatContext->streams[videoStreamIndex]->codecpar;
-        
-            const AVCodec* codec = avcodec_find_decoder(codecParameters->codec_id);
-            if (!codec) {
-                throw std::runtime_error("Unsupported codec");
-            }
-        
-            codecContext = avcodec_alloc_context3(codec);
-            if (!codecContext) {
-                throw std::runtime_error("Could not allocate codec context");
+            if (!decoded && avcodec_send_packet(_codecContext, nullptr) == 0) {
+                decoded = avcodec_receive_frame(_codecContext, _frame) == 0;
             }
-            
-            if (avcodec_parameters_to_context(codecContext, codecParameters) < 0) {
-                throw std::runtime_error("Could not copy codec parameters to context");
-            }
-        
-            if (avcodec_open2(codecContext, codec, nullptr) < 0) {
-                throw std::runtime_error("Could not open codec");
-            }
-        
-            frame = av_frame_alloc();
-            if (!frame) {
-                throw std::runtime_error("Could not allocate frame");
-            }
-        
-            packet = av_packet_alloc();
-            if (!packet) {
-                throw std::runtime_error("Could not allocate packet");
-            }
-            
-            while (av_read_frame(formatContext, packet) >= 0) {
-                if (packet->stream_index == videoStreamIndex) {
-                    if (avcodec_send_packet(codecContext, packet) == 0) {
-                        if (avcodec_receive_frame(codecContext, frame) == 0) {
-                            _width = frame->width;
-                            _height = frame->height;
-        
-                            if (codecContext->pix_fmt == AV_PIX_FMT_YUVJ420P) {
-                                codecContext->pix_fmt = AV_PIX_FMT_YUV420P;
-                                codecContext->color_range = AVCOL_RANGE_JPEG;
-                            }
-        
-                            int srcRange = (codecContext->color_range == AVCOL_RANGE_JPEG) ? 1 : 0;
-                            int dstRange = 1;
-        
-                            swsContext = sws_getContext(
-                                _width, 
-                                _height, 
-                                codecContext->pix_fmt, 
-                                _width, 
-                                _height, 
-                                AV_PIX_FMT_RGB24, 
-                                SWS_BILINEAR, 
-                                nullptr, 
-                                nullptr, 
-                                nullptr
-                            );
-                            if (!swsContext) {
-                                throw std::runtime_error("Could not create SwsContext");
-                            }
-        
-                            const int* coeffs = sws_getCoefficients(SWS_CS_DEFAULT);
-                            sws_setColorspaceDetails(
-                                swsContext, 
-                                coeffs, srcRange,
-                                coeffs, dstRange,
-                                0, 1 << 16, 1 << 16 
-                            );
-        
-                            _data.resize(_width * _height * 3);
-        
-                            uint8_t* dest[1] = {_data.data()};
-                            int destLinesize[1] = {static_cast<int>(_width) * 3};
-        
-                            sws_scale(swsContext, frame->data, frame->linesize, 0, _height, dest, destLinesize);
-                            
-                            av_packet_unref(packet);
-                            break;
-                        }
-                    }
-                }
-                av_packet_unref(packet);
+            if (!decoded) {
+                throw std::runtime_error("Could not decode image: " + filename);
             }
         }
         catch (...) {
-            if (packet) {
-                av_packet_free(&packet);
-            }
-            if (swsContext) {
-                sws_freeContext(swsContext);
-            }
-            if (frame) {
-                av_frame_free(&frame);
-            }
-            if (codecContext) {
-                avcodec_free_context(&codecContext);
-            }
-            if (formatContext) {
-                avformat_close_input(&formatContext);
-            }
+            avformat_close_input(&formatContext);
             throw;
         }
-        
-        if (packet) {
-            av_packet_free(&packet);
+        avformat_close_input(&formatContext);
+        return _frame;
+    }
+
+    // Converts the last decoded frame into caller-owned planes
+    void convert(AVPixelFormat format, int flags, uint8_t* const planes[4], const int strides[4]) {
+        AVPixelFormat sourceFormat = static_cast<AVPixelFormat>(_frame->format);
+        int srcRange = (_frame->color_range == AVCOL_RANGE_JPEG) ? 1 : 0;
+        if (sourceFormat == AV_PIX_FMT_YUVJ420P) {
+            sourceFormat = AV_PIX_FMT_YUV420P;
+            srcRange = 1;
+        }
+        int dstRange = 1;
+
+        _swsContext = sws_getCachedContext(
+            _swsContext,
+            _frame->width, _frame->height, sourceFormat,
+            _frame->width, _frame->height, format,
+            flags, nullptr, nullptr, nullptr
+        );
+        if (!_swsContext) {
+            throw std::runtime_error("Could not create SwsContext");
         }
-        if (swsContext) {
-            sws_freeContext(swsContext);
+
+        const int* coeffs = sws_getCoefficients(SWS_CS_DEFAULT);
+        sws_setColorspaceDetails(
+            _swsContext,
+            coeffs, srcRange,
+            coeffs, dstRange,
+            0, 1 << 16, 1 << 16
+        );
+
+        sws_scale(_swsContext, _frame->data, _frame->linesize, 0, _frame->height, planes, strides);
+    }
+
+private:
+    struct ParametersDeleter {
+        void operator()(AVCodecParameters* parameters) const { avcodec_parameters_free(&parameters); }
+    };
+
+    AVCodecContext* _codecContext = nullptr;
+    std::unique_ptr<AVCodecParameters, ParametersDeleter> _codecParameters;
+    SwsContext* _swsContext = nullptr;
+    AVFrame* _frame = nullptr;
+    AVPacket* _packet = nullptr;
+
+    AVFormatContext* open(const std::string& filename, int& streamIndex) const {
+        AVFormatContext* formatContext = nullptr;
+        if (avformat_open_input(&formatContext, filename.c_str(), nullptr, nullptr) != 0) {
+            throw std::runtime_error("Could not open file: " + filename);
         }
-        if (frame) {
-            av_frame_free(&frame);
+
+        if (avformat_find_stream_info(formatContext, nullptr) < 0) {
+            avformat_close_input(&formatContext);
+            throw std::runtime_error("Could not find stream information");
         }
-        if (codecContext) {
-            avcodec_free_context(&codecContext);
+
+        streamIndex = -1;
+        for (size_t i = 0; i < formatContext->nb_streams; i++) {
+            if (formatContext->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
+                streamIndex = i;
+                break;
+            }
         }
-        if (formatContext) {
+        if (streamIndex == -1) {
             avformat_close_input(&formatContext);
+            throw std::runtime_error("Could not find video stream");
         }
+        return formatContext;
     }
 
-    void save(bool saveCopy, int args_id, int thread_num, const std::string& filename) const override {    
-        AVFormatContext* outputContext = nullptr;
-        if (avformat_alloc_output_context2(&outputContext, nullptr, nullptr, filename.c_str()) < 0) {
-            throw std::runtime_error("Could not create output context");
+    // An open decoder is flushed and reused only for a stream with identical parameters;
+    // anything else (size, format, extradata) gets a fresh context built from the new codecpar
+    void openCodec(const AVCodecParameters* codecParameters) {
+        if (!_frame && !(_frame = av_frame_alloc())) {
+            throw std::runtime_error("Could not allocate frame");
         }
-    
-        if (!(outputContext->oformat->flags & AVFMT_NOFILE)) {
-            if (avio_open(&outputContext->pb, filename.c_str(), AVIO_FLAG_WRITE) < 0) {
-                avformat_free_context(outputContext);
-                throw std::runtime_error("Could not open output file"); 
-            }
+        if (!_packet && !(_packet = av_packet_alloc())) {
+            throw std::runtime_error("Could not allocate packet");
         }
-    
-        AVStream* stream = avformat_new_stream(outputContext, nullptr);
-        if (!stream) {
-            avformat_free_context(outputContext);
-            throw std::runtime_error("Could not create stream");
+
+        if (sameParameters(codecParameters)) {
+            avcodec_flush_buffers(_codecContext);
+            return;
         }
-    
-        const AVCodec* codec = avcodec_find_encoder(AV_CODEC_ID_PNG);
+        avcodec_free_context(&_codecContext);
+
+        const AVCodec* codec = avcodec_find_decoder(codecParameters->codec_id);
         if (!codec) {
-            avformat_free_context(outputContext);
-            throw std::runtime_error("PNG codec not found");
+            throw std::runtime_error("Unsupported codec");
         }
-    
-        AVCodecContext* codecContext = avcodec_alloc_context3(codec);
-        if (!codecContext) {
-            avformat_free_context(outputContext);
+
+        _codecContext = avcodec_alloc_context3(codec);
+        if (!_codecContext) {
             throw std::runtime_error("Could not allocate codec context");
         }
-    
-        codecContext->width = _width;
-        codecContext->height = _height;
-        codecContext->pix_fmt = AV_PIX_FMT_RGB24;
-        codecContext->time_base = {1, 25};
-    
-        stream->time_base = codecContext->time_base;
-        avcodec_parameters_from_context(stream->codecpar, codecContext);
-    
-        if (avcodec_open2(codecContext, codec, nullptr) < 0) {
-            avcodec_free_context(&codecContext);
-            avformat_free_context(outputContext);
+
+        if (avcodec_parameters_to_context(_codecContext, codecParameters) < 0) {
+            avcodec_free_context(&_codecContext);
+            throw std::runtime_error("Could not copy codec parameters to context");
+        }
+
+        if (avcodec_open2(_codecContext, codec, nullptr) < 0) {
+            avcodec_free_context(&_codecContext);
             throw std::runtime_error("Could not open codec");
         }
-    
-        AVFrame* frame = av_frame_alloc();
-        if (!frame) {
-            avcodec_free_context(&codecContext);
-            avformat_free_context(outputContext);
-            throw std::runtime_error("Could not allocate frame");
+        _codecParameters.reset(avcodec_parameters_alloc());
+        if (!_codecParameters || avcodec_parameters_copy(_codecParameters.get(), codecParameters) < 0) {
+            _codecParameters.reset();
         }
-    
-        frame->format = codecContext->pix_fmt;
-        frame->width = codecContext->width;
-        frame->height = codecContext->height;
-        if (av_frame_get_buffer(frame, 0) < 0) {
-            av_frame_free(&frame);
-            avcodec_free_context(&codecContext);
+    }
+
+    bool sameParameters(const AVCodecParameters* codecParameters) const {
+        const AVCodecParameters* current = _codecParameters.get();
+        return _codecContext && current &&
+               current->codec_id == codecParameters->codec_id &&
+               current->width == codecParameters->width &&
+               current->height == codecParameters->height &&
+               current->format == codecParameters->format &&
+               current->extradata_size == codecParameters->extradata_size &&
+               (current->extradata_size == 0 ||
+                std::memcmp(current->extradata, codecParameters->extradata, current->extradata_size) == 0);
+    }
+};
+
+// Writes one image as PNG, converting from the stored pixel format
+inline void encodeImage(const std::string& filename, size_t width, size_t height, AVPixelFormat format, AVPixelFormat saveFormat,
+                        const uint8_t* const planes[4], const int strides[4]) {
+    AVFormatContext* outputContext = nullptr;
+    if (avformat_alloc_output_context2(&outputContext, nullptr, nullptr, filename.c_str()) < 0) {
+        throw std::runtime_error("Could not create output context");
+    }
+
+    if (!(outputContext->oformat->flags & AVFMT_NOFILE)) {
+        if (avio_open(&outputContext->pb, filename.c_str(), AVIO_FLAG_WRITE) < 0) {
             avformat_free_context(outputContext);
-            throw std::runtime_error("Could not allocate frame buffer");
+            throw std::runtime_error("Could not open output file"); 
         }
-    
-        if (av_frame_make_writable(frame) < 0) {
-            av_frame_free(&frame);
-            avcodec_free_context(&codecContext);
-            avformat_free_context(outputContext);
-            throw std::runtime_error("Frame is not writable");
-        }
-    
-        uint8_t* srcData;
-        if (saveCopy) {
-            auto data = std::get<0>(_copy);
-            srcData = new uint8_t[_width * _height * 3];
-            for (size_t y = 0; y < _height; ++y) {
-                for (size_t x = 0; x < _width; ++x) {
-                    size_t index = (y * _width + x) * 3;
-                    srcData[index] = data[y][x].R;
-                    srcData[index + 1] = data[y][x].G;
-                    srcData[index + 2] = data[y][x].B;
-                }
-                memcpy(frame->data[0] + y * frame->linesize[0], srcData + y * _width * 3, _width * 3);
+    }
+
+    AVStream* stream = avformat_new_stream(outputContext, nullptr);
+    if (!stream) {
+        avformat_free_context(outputContext);
+        throw std::runtime_error("Could not create stream");
+    }
+
+    const AVCodec* codec = avcodec_find_encoder(AV_CODEC_ID_PNG);
+    if (!codec) {
+        avformat_free_context(outputContext);
+        throw std::runtime_error("PNG codec not found");
+    }
+
+    AVCodecContext* codecContext = avcodec_alloc_context3(codec);
+    if (!codecContext) {
+        avformat_free_context(outputContext);
+        throw std::runtime_error("Could not allocate codec context");
+    }
+
+    codecContext->width = width;
+    codecContext->height = height;
+    codecContext->pix_fmt = saveFormat;
+    codecContext->time_base = {1, 25};
+
+    stream->time_base = codecContext->time_base;
+    avcodec_parameters_from_context(stream->codecpar, codecContext);
+
+    if (avcodec_open2(codecContext, codec, nullptr) < 0) {
+        avcodec_free_context(&codecContext);
+        avformat_free_context(outputContext);
+        throw std::runtime_error("Could not open codec");
+    }
+
+    AVFrame* frame = av_frame_alloc();
+    if (!frame) {
+        avcodec_free_context(&codecContext);
+        avformat_free_context(outputContext);
+        throw std::runtime_error("Could not allocate frame");
+    }
+
+    frame->format = codecContext->pix_fmt;
+    frame->width = codecContext->width;
+    frame->height = codecContext->height;
+    if (av_frame_get_buffer(frame, 0) < 0) {
+        av_frame_free(&frame);
+        avcodec_free_context(&codecContext);
+        avformat_free_context(outputContext);
+        throw std::runtime_error("Could not allocate frame buffer");
+    }
+
+    if (av_frame_make_writable(frame) < 0) {
+        av_frame_free(&frame);
+        avcodec_free_context(&codecContext);
+        avformat_free_context(outputContext);
+        throw std::runtime_error("Frame is not writable");
+    }
+
+    SwsContext* swsContext = sws_getContext(
+        width, height, format,
+        width, height, saveFormat,
+        SWS_POINT, nullptr, nullptr, nullptr
+    );
+    if (!swsContext) {
+        av_frame_free(&frame);
+        avcodec_free_context(&codecContext);
+        avformat_free_context(outputContext);
+        throw std::runtime_error("Could not create SwsContext");
+    }
+
+    sws_scale(swsContext, planes, strides, 0, height, frame->data, frame->linesize);
+    sws_freeContext(swsContext);
+
+    AVPacket* packet = av_packet_alloc();
+    if (!packet) {
+        av_frame_free(&frame);
+        avcodec_free_context(&codecContext);
+        avformat_free_context(outputContext);
+        throw std::runtime_error("Could not allocate packet");
+    }
+
+    AVDictionary *options = nullptr;
+    av_dict_set(&options, "update", "1", 0);
+    av_dict_set(&options, "frames:v", "1", 0);
+
+    if (avformat_write_header(outputContext, &options) < 0) {
+        av_dict_free(&options);
+        av_packet_free(&packet);
+        av_frame_free(&frame);
+        avcodec_free_context(&codecContext);
+        avformat_free_context(outputContext);
+        throw std::runtime_error("Could not write header");
+    }
+
+    frame->pts = 0;
+
+    if (avcodec_send_frame(codecContext, frame) == 0) {
+        if (avcodec_receive_packet(codecContext, packet) == 0) {
+            if (av_write_frame(outputContext, packet) < 0) {
+                av_packet_free(&packet);
+                av_frame_free(&frame);
+                avcodec_free_context(&codecContext);
+                avformat_free_context(outputContext);
+                throw std::runtime_error("Could not write frame");
             }
-        } else {
-            for(int y = 0; y < _height; y++) {
-                memcpy(frame->data[0] + y * frame->linesize[0], _data.data() + y * _width * 3, _width * 3);
+            av_packet_unref(packet);
+        }
+    }
+
+    av_write_trailer(outputContext);
+
+    av_dict_free(&options);
+    av_packet_free(&packet);
+    av_frame_free(&frame);
+    avcodec_free_context(&codecContext);
+    if (!(outputContext->oformat->flags & AVFMT_NOFILE)) {
+        avio_closep(&outputContext->pb);
+    }
+    avformat_free_context(outputContext);
+}
+enum class ImagePattern {
+    Noise,
+    Gradient,
+    Checkerboard,
+    Perlin
+};
+
+template <typename Layout>
+class BasicDataImage : public Data<typename Layout::Metadata> {
+public:
+    using Metadata = typename Layout::Metadata;
+    using Element = typename Layout::Element;
+
+    BasicDataImage(const std::string& filename) {
+        this->_filename = filename;
+    }
+
+    // Generated images never touch disk: pixels are produced in read() from the seed.
+    // cellSize is the checkerboard cell and the coarsest Perlin lattice period.
+    BasicDataImage(ImagePattern pattern, size_t width, size_t height, unsigned int seed = 0, size_t cellSize = 64)
+        : _width(width), _height(height), _generated(true), _pattern(pattern), _seed(seed), _cellSize(std::max<size_t>(1, cellSize)) {
+        if (static_cast<int>(pattern) < static_cast<int>(ImagePattern::Noise) || static_cast<int>(pattern) > static_cast<int>(ImagePattern::Perlin)) {
+            throw std::invalid_argument("Invalid image pattern");
+        }
+        static const char* names[] = {"noise", "gradient", "checkerboard", "perlin"};
+        this->_filename = std::string(names[static_cast<int>(pattern)]) + "_" + std::to_string(width) + "x" + std::to_string(height) + "_" + std::to_string(seed);
+    }
+
+    void read() override {
+        if (!this->_filename.empty()) {
+            load();
+        }
+    }
+
+    void clear() override {
+        _data.reset();
+    }
+
+    Metadata& copy() override {
+        clear_copy();
+
+        _copyBuffer.resize(_data.size());
+        parallelCopy(_copyBuffer.data(), _data.data(), _data.size());
+        this->_copy = metadata(_copyBuffer);
+        return this->_copy;
+    }
+
+    Metadata& restore() override {
+        if (_copyBuffer.empty()) {
+            return copy();
+        }
+        parallelCopy(_copyBuffer.data(), _data.data(), _data.size());
+        return this->_copy;
+    }
+
+    Metadata& share() override {
+        Layout::release(this->_view);
+        this->_view = metadata(_data);
+        return this->_view;
+    }
+
+    void clear_copy() override {
+        if (!_copyBuffer.empty()) {
+            Layout::release(this->_copy);
+            this->_copy = Metadata();
+            _copyBuffer.reset();
+        }
+        Layout::release(this->_view);
+        this->_view = Metadata();
+    }
+
+    const std::string save_copy(const std::string& dirname, int args_id, int thread_num) const override {
+        if (!_copyBuffer.empty()) {
+            std::string filename = "proc" + this->proc_data_str(args_id, thread_num) + "_" + this->_filename + ".png";
+            std::filesystem::path file_path = std::filesystem::path(dirname) / filename;
+            save(true, args_id, thread_num, file_path);
+            return filename;
+        }
+        throw std::runtime_error("Copy data not found");
+    }
+
+    std::pair<std::string, std::function<void()>> detach_copy(const std::string& dirname, int args_id, int thread_num) override {
+        if (_copyBuffer.empty()) {
+            throw std::runtime_error("Copy data not found");
+        }
+        std::string filename = "proc" + this->proc_data_str(args_id, thread_num) + "_" + this->_filename + ".png";
+        std::filesystem::path file_path = std::filesystem::path(dirname) / filename;
+
+        Layout::release(this->_copy);
+        this->_copy = Metadata();
+        auto buffer = std::make_shared<AlignedBuffer>(std::move(_copyBuffer));
+        return {filename, [buffer, file_path, width = _width, height = _height, stride = _stride]() {
+            uint8_t* planes[4] = {nullptr};
+            int strides[4] = {0};
+            swsPlanes(buffer->data(), height, stride, planes, strides);
+            encodeImage(file_path.string(), width, height, Layout::format, Layout::saveFormat, planes, strides);
+        }};
+    }
+
+    const std::string title() const override {
+        return "Изображение " + std::to_string(_width) + " на " + std::to_string(_height) + " пикселей.";
+    }
+
+    const std::string type() const override {
+        return std::string("image");
+    }
+
+private:
+    AlignedBuffer _data;
+    AlignedBuffer _copyBuffer;
+    size_t _width = 0;
+    size_t _height = 0;
+    size_t _stride = 0;
+    bool _generated = false;
+    ImagePattern _pattern = ImagePattern::Noise;
+    unsigned int _seed = 0;
+    size_t _cellSize = 64;
+
+    void allocate(size_t width, size_t height) {
+        _width = width;
+        _height = height;
+        _stride = alignedSize(width * Layout::pixelElements * sizeof(Element));
+        _data.resize(Layout::planes * _height * _stride);
+    }
+
+    Metadata metadata(const AlignedBuffer& buffer) const {
+        Element* planes[Layout::planes];
+        for (size_t p = 0; p < Layout::planes; ++p) {
+            planes[p] = reinterpret_cast<Element*>(buffer.data() + p * _height * _stride);
+        }
+        return Layout::metadata(planes, _height, _width, _stride / sizeof(Element));
+    }
+
+    void swsPlanes(const AlignedBuffer& buffer, uint8_t* planes[4], int strides[4]) const {
+        swsPlanes(buffer.data(), _height, _stride, planes, strides);
+    }
+
+    static void swsPlanes(uint8_t* data, size_t height, size_t stride, uint8_t* planes[4], int strides[4]) {
+        for (size_t i = 0; i < Layout::planes; ++i) {
+            planes[i] = data + Layout::swsPlanes[i] * height * stride;
+            strides[i] = static_cast<int>(stride);
+        }
+    }
+
+    static uint64_t hash(uint64_t x) {
+        x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+        return x ^ (x >> 31);
+    }
+
+    static double hashUniform(uint64_t seed, uint64_t x, uint64_t y) {
+        return (hash(seed ^ hash(x * 0x9E3779B97F4A7C15ULL + y)) >> 11) * (1.0 / 9007199254740992.0);
+    }
+
+    // Gradient noise over a hashed lattice with one of eight fixed directions per node
+    static double perlin(uint64_t seed, double x, double y) {
+        static const double directions[8][2] = {{1, 0}, {-1, 0}, {0, 1}, {0, -1}, {0.7071, 0.7071}, {-0.7071, 0.7071}, {0.7071, -0.7071}, {-0.7071, -0.7071}};
+        const double fx = std::floor(x), fy = std::floor(y);
+        const double dx = x - fx, dy = y - fy;
+        const int64_t ix = static_cast<int64_t>(fx), iy = static_cast<int64_t>(fy);
+
+        auto node = [&](int64_t cx, int64_t cy, double ox, double oy) {
+            const double* g = directions[hash(seed ^ hash(uint64_t(cx) * 0x9E3779B97F4A7C15ULL + uint64_t(cy))) & 7];
+            return g[0] * ox + g[1] * oy;
+        };
+        auto fade = [](double t) { return t * t * t * (t * (t * 6 - 15) + 10); };
+
+        const double u = fade(dx), v = fade(dy);
+        const double top = node(ix, iy, dx, dy) + u * (node(ix + 1, iy, dx - 1, dy) - node(ix, iy, dx, dy));
+        const double bottom = node(ix, iy + 1, dx, dy - 1) + u * (node(ix + 1, iy + 1, dx - 1, dy - 1) - node(ix, iy + 1, dx, dy - 1));
+        return top + v * (bottom - top);
+    }
+
+    double sample(size_t x, size_t y, size_t channel) const {
+        const uint64_t seed = hash(_seed + 0x9E3779B97F4A7C15ULL * (channel + 1));
+        switch (_pattern) {
+            case ImagePattern::Noise:
+                return hashUniform(seed, x, y);
+            case ImagePattern::Gradient: {
+                const double gx = _width > 1 ? double(x) / (_width - 1) : 0.0;
+                const double gy = _height > 1 ? double(y) / (_height - 1) : 0.0;
+                return channel == 0 ? gx : (channel == 1 ? gy : (gx + gy) / 2);
+            }
+            case ImagePattern::Checkerboard:
+                return ((x / _cellSize + y / _cellSize) & 1) ? 1.0 : 0.0;
+            case ImagePattern::Perlin: {
+                double value = 0.0, amplitude = 0.5, frequency = 1.0 / _cellSize;
+                for (int octave = 0; octave < 5; ++octave) {
+                    value += amplitude * perlin(seed + octave, x * frequency, y * frequency);
+                    amplitude *= 0.5;
+                    frequency *= 2.0;
+                }
+                return std::clamp(0.5 + value, 0.0, 1.0);
             }
         }
-    
-        AVPacket* packet = av_packet_alloc();
-        if (!packet) {
-            av_frame_free(&frame);
-            avcodec_free_context(&codecContext);
-            avformat_free_context(outputContext);
-            throw std::runtime_error("Could not allocate packet");
+        return 0.0;  // unreachable, the constructor rejects unknown patterns
+    }
+
+    static Element element(double value) {
+        if constexpr (std::is_floating_point_v<Element>) {
+            return static_cast<Element>(value);
+        } else {
+            return static_cast<Element>(value * std::numeric_limits<Element>::max() + 0.5);
         }
-    
-        AVDictionary *options = nullptr;
-        av_dict_set(&options, "update", "1", 0);
-        av_dict_set(&options, "frames:v", "1", 0);
+    }
 
-        if (avformat_write_header(outputContext, &options) < 0) {
-            av_dict_free(&options);
-            av_packet_free(&packet);
-            av_frame_free(&frame);
-            avcodec_free_context(&codecContext);
-            avformat_free_context(outputContext);
-            throw std::runtime_error("Could not write header");
-        }
-    
-        frame->pts = 0;
-
-        if (avcodec_send_frame(codecContext, frame) == 0) {
-            if (avcodec_receive_packet(codecContext, packet) == 0) {
-                if (av_write_frame(outputContext, packet) < 0) {
-                    av_packet_free(&packet);
-                    av_frame_free(&frame);
-                    avcodec_free_context(&codecContext);
-                    avformat_free_context(outputContext);
-                    throw std::runtime_error("Could not write frame");
+    // Rows are independent, so the result does not depend on the thread count
+    void generate() {
+        allocate(_width, _height);
+        constexpr size_t pixelElements = Layout::pixelElements;
+
+        #pragma omp parallel for schedule(static)
+        for (size_t y = 0; y < _height; ++y) {
+            Element* rows[Layout::planes];
+            for (size_t p = 0; p < Layout::planes; ++p) {
+                rows[p] = reinterpret_cast<Element*>(_data.data() + (p * _height + y) * _stride);
+            }
+            for (size_t x = 0; x < _width; ++x) {
+                if constexpr (Layout::planes == 3) {
+                    for (size_t c = 0; c < 3; ++c) {
+                        rows[c][x] = element(sample(x, y, c));
+                    }
+                } else if constexpr (pixelElements == 1) {
+                    rows[0][x] = element(0.299 * sample(x, y, 0) + 0.587 * sample(x, y, 1) + 0.114 * sample(x, y, 2));
+                } else {
+                    for (size_t c = 0; c < pixelElements; ++c) {
+                        rows[0][x * pixelElements + c] = element(c < 3 ? sample(x, y, c) : 1.0);
+                    }
                 }
-                av_packet_unref(packet);
             }
         }
-    
-        av_write_trailer(outputContext);
+    }
 
-        av_dict_free(&options);
-        av_packet_free(&packet);
-        av_frame_free(&frame);
-        avcodec_free_context(&codecContext);
-        if (!(outputContext->oformat->flags & AVFMT_NOFILE)) {
-            avio_closep(&outputContext->pb);
+    void load() override {
+        if (_generated) {
+            generate();
+            return;
         }
-        avformat_free_context(outputContext);
+
+        std::vector<uint64_t> params;
+        if (MediaCache::load(this->_filename, cacheFormat(), _data, params) && params.size() == 3 &&
+            _data.size() == Layout::planes * params[1] * params[2]) {
+            _width = params[0];
+            _height = params[1];
+            _stride = params[2];
+            return;
+        }
+
+        ImageDecoder decoder;
+        const AVFrame* frame = decoder.decode(this->_filename);
+        allocate(frame->width, frame->height);
+
+        uint8_t* dest[4] = {nullptr};
+        int destLinesize[4] = {0};
+        swsPlanes(_data, dest, destLinesize);
+        decoder.convert(Layout::format, Layout::swsFlags, dest, destLinesize);
+        MediaCache::store(this->_filename, cacheFormat(), _data.data(), _data.size(), {_width, _height, _stride});
+    }
+
+    static std::string cacheFormat() {
+        return "image:" + std::to_string(Layout::format) + ":" + std::to_string(Layout::planes) + ":" +
+               std::to_string(Layout::pixelElements * sizeof(Element)) + ":" + std::to_string(Layout::swsFlags);
+    }
+
+    void save(bool saveCopy, int args_id, int thread_num, const std::string& filename) const override {
+        uint8_t* planes[4] = {nullptr};
+        int strides[4] = {0};
+        swsPlanes(saveCopy ? _copyBuffer : _data, planes, strides);
+        encodeImage(filename, _width, _height, Layout::format, Layout::saveFormat, planes, strides);
     }
 };
 
+using DataImage = BasicDataImage<ImageRowsLayout>;
+using DataImagePacked = BasicDataImage<PackedRGBLayout>;
+using DataImagePlanar = BasicDataImage<PlanarRGBLayout>;
+using DataImageRGBA = BasicDataImage<RGBALayout>;
+using DataImageGray8 = BasicDataImage<Gray8Layout>;
+using DataImageGray16 = BasicDataImage<Gray16Layout>;
+using DataImageRGB48 = BasicDataImage<RGB48Layout>;
+using DataImagePlanarFloat = BasicDataImage<PlanarFloatLayout>;
+
 #endif
\ No newline at end of file
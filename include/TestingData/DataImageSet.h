@@ -0,0 +1,302 @@
+#ifndef DATA_IMAGE_SET_H
+#define DATA_IMAGE_SET_H
+
+#include "Data.h"
+#include "DataImage.h"
+#include "MediaCache.h"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <exception>
+#include <filesystem>
+#include <omp.h>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <glob.h>
+#endif
+
+template <typename T>
+using MetadataImageSet = std::tuple<
+    T**,            // Image planes in layout order, count * planes entries
+    const size_t*,  // Image heights
+    const size_t*,  // Image widths
+    const size_t*,  // Row strides in elements
+    size_t          // Image count
+>;
+
+// Lists images of a directory, or files matching a glob pattern, in sorted order
+inline std::vector<std::string> listImageFiles(const std::string& source) {
+    static const std::vector<std::string> extensions = {".png", ".jpg", ".jpeg", ".bmp", ".tif", ".tiff", ".webp", ".ppm", ".pgm", ".gif"};
+
+    std::vector<std::string> files;
+    if (std::filesystem::is_directory(source)) {
+        for (const auto& entry : std::filesystem::directory_iterator(source)) {
+            std::string extension = entry.path().extension().string();
+            std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return std::tolower(c); });
+            if (entry.is_regular_file() && std::find(extensions.begin(), extensions.end(), extension) != extensions.end()) {
+                files.push_back(entry.path().string());
+            }
+        }
+    } else {
+#if defined(__unix__) || defined(__APPLE__)
+        glob_t matches;
+        if (glob(source.c_str(), 0, nullptr, &matches) == 0) {
+            for (size_t i = 0; i < matches.gl_pathc; ++i) {
+                files.emplace_back(matches.gl_pathv[i]);
+            }
+        }
+        globfree(&matches);
+#else
+        if (std::filesystem::is_regular_file(source)) {
+            files.push_back(source);
+        }
+#endif
+    }
+    std::sort(files.begin(), files.end());
+
+    if (files.empty()) {
+        throw std::runtime_error("No images found: " + source);
+    }
+    return files;
+}
+
+// All images are decoded into one aligned arena. Every worker of the decode pool keeps
+// its own ImageDecoder, so codec and scaler contexts are reused across files.
+template <typename Layout>
+class BasicDataImageSet : public Data<MetadataImageSet<typename Layout::Element>> {
+public:
+    using Element = typename Layout::Element;
+    using Metadata = MetadataImageSet<Element>;
+
+    BasicDataImageSet(const std::string& source, int threads = 0) : _threads(threads) {
+        this->_filename = source;
+    }
+
+    void read() override {
+        if (!this->_filename.empty()) {
+            load();
+        }
+    }
+
+    void clear() override {
+        _data.reset();
+        _files.clear();
+        _files.shrink_to_fit();
+        _offsets.clear();
+        _offsets.shrink_to_fit();
+        _heights.clear();
+        _heights.shrink_to_fit();
+        _widths.clear();
+        _widths.shrink_to_fit();
+        _strides.clear();
+        _strides.shrink_to_fit();
+    }
+
+    Metadata& copy() override {
+        clear_copy();
+
+        _copyBuffer.resize(_data.size());
+        parallelCopy(_copyBuffer.data(), _data.data(), _data.size());
+
+        this->_copy = metadata(_copyBuffer);
+        return this->_copy;
+    }
+
+    Metadata& restore() override {
+        if (_copyBuffer.empty()) {
+            return copy();
+        }
+        parallelCopy(_copyBuffer.data(), _data.data(), _data.size());
+        return this->_copy;
+    }
+
+    Metadata& share() override {
+        delete[] std::get<0>(this->_view);
+        this->_view = metadata(_data);
+        return this->_view;
+    }
+
+    void clear_copy() override {
+        delete[] std::get<0>(this->_copy);
+        this->_copy = Metadata();
+        _copyBuffer.reset();
+        delete[] std::get<0>(this->_view);
+        this->_view = Metadata();
+    }
+
+    const std::string save_copy(const std::string& dirname, int args_id, int thread_num) const override {
+        if (std::get<0>(this->_copy)) {
+            std::string filename = "proc" + this->proc_data_str(args_id, thread_num) + "_" + setName();
+            std::filesystem::path file_path = std::filesystem::path(dirname) / filename;
+            save(true, args_id, thread_num, file_path);
+            return filename;
+        }
+        throw std::runtime_error("Copy data not found");
+    }
+
+    const std::string title() const override {
+        return "Набор из " + std::to_string(count()) + " изображений общим объёмом " + std::to_string(_data.size()) + " байт.";
+    }
+
+    const std::string type() const override {
+        return std::string("image_set");
+    }
+
+private:
+    AlignedBuffer _data;
+    AlignedBuffer _copyBuffer;
+    std::vector<std::string> _files;
+    std::vector<size_t> _offsets;
+    std::vector<size_t> _heights;
+    std::vector<size_t> _widths;
+    std::vector<size_t> _strides;
+    int _threads;
+
+    size_t count() const {
+        return _files.size();
+    }
+
+    std::string setName() const {
+        std::filesystem::path source(this->_filename);
+        std::string name = source.has_filename() ? source.filename().string() : source.parent_path().filename().string();
+        std::replace_if(name.begin(), name.end(), [](char c) { return c == '*' || c == '?' || c == '[' || c == ']'; }, '_');
+        return name;
+    }
+
+    uint8_t* plane(const AlignedBuffer& buffer, size_t image, size_t p) const {
+        return buffer.data() + _offsets[image] + p * _heights[image] * _strides[image] * sizeof(Element);
+    }
+
+    Metadata metadata(const AlignedBuffer& buffer) {
+        Element** planes = new Element*[count() * Layout::planes];
+        for (size_t i = 0; i < count(); ++i) {
+            for (size_t p = 0; p < Layout::planes; ++p) {
+                planes[i * Layout::planes + p] = reinterpret_cast<Element*>(plane(buffer, i, p));
+            }
+        }
+        return std::make_tuple(planes, _heights.data(), _widths.data(), _strides.data(), count());
+    }
+
+    void swsPlanes(const AlignedBuffer& buffer, size_t image, uint8_t* planes[4], int strides[4]) const {
+        for (size_t i = 0; i < Layout::planes; ++i) {
+            planes[i] = plane(buffer, image, Layout::swsPlanes[i]);
+            strides[i] = static_cast<int>(_strides[image] * sizeof(Element));
+        }
+    }
+
+    // Exceptions cannot leave an OpenMP region, so the first one is kept and rethrown
+    template <typename Body>
+    void parallelFor(size_t count, Body body) const {
+        std::exception_ptr error;
+        std::atomic<bool> failed(false);
+        #pragma omp parallel num_threads(_threads > 0 ? _threads : omp_get_max_threads())
+        {
+            ImageDecoder decoder;
+            #pragma omp for schedule(dynamic, 1)
+            for (size_t i = 0; i < count; ++i) {
+                if (failed) continue;
+                try {
+                    body(decoder, i);
+                } catch (...) {
+                    if (!failed.exchange(true)) error = std::current_exception();
+                }
+            }
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+    void save(bool saveCopy, int args_id, int thread_num, const std::string& filename) const override {
+        std::filesystem::create_directories(filename);
+        const AlignedBuffer& buffer = saveCopy ? _copyBuffer : _data;
+
+        parallelFor(count(), [&](ImageDecoder&, size_t i) {
+            uint8_t* planes[4] = {nullptr};
+            int strides[4] = {0};
+            swsPlanes(buffer, i, planes, strides);
+            std::filesystem::path file_path = std::filesystem::path(filename) / std::filesystem::path(_files[i]).stem();
+            encodeImage(file_path.string() + ".png", _widths[i], _heights[i], Layout::format, Layout::saveFormat, planes, strides);
+        });
+    }
+
+    // Places every image in the arena from its size and returns the arena size
+    size_t arrange() {
+        _offsets.assign(count(), 0);
+        _strides.assign(count(), 0);
+        size_t size = 0;
+        for (size_t i = 0; i < count(); ++i) {
+            _offsets[i] = size;
+            _strides[i] = alignedSize(_widths[i] * Layout::pixelElements * sizeof(Element)) / sizeof(Element);
+            size += Layout::planes * _heights[i] * _strides[i] * sizeof(Element);
+        }
+        return size;
+    }
+
+    static std::string cacheFormat() {
+        return "image_set:" + std::to_string(Layout::format) + ":" + std::to_string(Layout::planes) + ":" +
+               std::to_string(Layout::pixelElements * sizeof(Element)) + ":" + std::to_string(Layout::swsFlags);
+    }
+
+    // The entry stores the image count followed by the width and height of every image
+    bool loadCached() {
+        std::vector<uint64_t> params;
+        if (!MediaCache::load(this->_filename, _files, cacheFormat(), _data, params) ||
+            params.size() != 1 + 2 * count() || params[0] != count()) {
+            return false;
+        }
+        _widths.assign(params.begin() + 1, params.begin() + 1 + count());
+        _heights.assign(params.begin() + 1 + count(), params.end());
+        if (arrange() != _data.size()) {
+            _data.reset();
+            return false;
+        }
+        return true;
+    }
+
+    // Headers are probed first so the arena is allocated once and decoded in place
+    void load() override {
+        _files = listImageFiles(this->_filename);
+        if (loadCached()) {
+            return;
+        }
+
+        _heights.assign(count(), 0);
+        _widths.assign(count(), 0);
+        parallelFor(count(), [&](ImageDecoder& decoder, size_t i) {
+            decoder.probe(_files[i], _widths[i], _heights[i]);
+        });
+        _data.resize(arrange());
+
+        parallelFor(count(), [&](ImageDecoder& decoder, size_t i) {
+            const AVFrame* frame = decoder.decode(_files[i]);
+            if (size_t(frame->width) != _widths[i] || size_t(frame->height) != _heights[i]) {
+                throw std::runtime_error("Decoded size differs from header: " + _files[i]);
+            }
+
+            uint8_t* dest[4] = {nullptr};
+            int destLinesize[4] = {0};
+            swsPlanes(_data, i, dest, destLinesize);
+            decoder.convert(Layout::format, Layout::swsFlags, dest, destLinesize);
+        });
+
+        std::vector<uint64_t> params = {count()};
+        params.insert(params.end(), _widths.begin(), _widths.end());
+        params.insert(params.end(), _heights.begin(), _heights.end());
+        MediaCache::store(this->_filename, _files, cacheFormat(), _data.data(), _data.size(), params);
+    }
+};
+
+using DataImageSet = BasicDataImageSet<PackedRGBLayout>;
+using DataImageSetRGBA = BasicDataImageSet<RGBALayout>;
+using DataImageSetGray8 = BasicDataImageSet<Gray8Layout>;
+using DataImageSetGray16 = BasicDataImageSet<Gray16Layout>;
+using DataImageSetRGB48 = BasicDataImageSet<RGB48Layout>;
+using DataImageSetPlanar = BasicDataImageSet<PlanarRGBLayout>;
+using DataImageSetPlanarFloat = BasicDataImageSet<PlanarFloatLayout>;
+
+#endif
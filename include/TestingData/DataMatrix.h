@@ -87,6 +87,8 @@ public:
         }
         _data.clear();
         _data.shrink_to_fit();
+        _rows.clear();
+        _rows.shrink_to_fit();
     }
 
     MetadataMatrix<T>& copy() override {
@@ -102,6 +104,27 @@ public:
         return this->_copy;
     }
 
+    MetadataMatrix<T>& restore() override {
+        T** copy = std::get<0>(this->_copy);
+        if (!copy) {
+            return this->copy();
+        }
+        #pragma omp parallel for schedule(static)
+        for (size_t i = 0; i < _data.size(); ++i) {
+            std::copy(_data[i].begin(), _data[i].end(), copy[i]);
+        }
+        return this->_copy;
+    }
+
+    MetadataMatrix<T>& share() override {
+        _rows.resize(_data.size());
+        for (size_t i = 0; i < _data.size(); ++i) {
+            _rows[i] = _data[i].data();
+        }
+        this->_view = std::make_tuple(_rows.data(), _data.size(), _data.back().size());
+        return this->_view;
+    }
+
     void clear_copy() override {
         try {
             auto data = std::get<0>(this->_copy);
@@ -111,6 +134,7 @@ public:
                     delete[] arr[i];
                 }
                 delete[] arr;
+                std::get<0>(this->_copy) = nullptr;
             }
         } catch (const std::bad_variant_access& e) {
             return;
@@ -143,6 +167,7 @@ public:
 
 private:
     std::vector<std::vector<T>> _data;
+    std::vector<T*> _rows;
 
     void fillRandom(T min, T max) {
         std::random_device rd;
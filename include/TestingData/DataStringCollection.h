@@ -0,0 +1,254 @@
+#ifndef DATA_STRING_COLLECTION_H
+#define DATA_STRING_COLLECTION_H
+
+#include "Data.h"
+#include "DataText.h"
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+
+using MetadataStringCollection = std::tuple<
+    char*,      // Arena with all strings stored back to back
+    size_t*,    // String offsets into the arena, count + 1 entries
+    size_t      // String count
+>;
+
+enum class StringLengthDistribution {
+    Fixed,
+    Uniform,
+    Normal,
+    Exponential
+};
+
+class DataStringCollection : public Data<MetadataStringCollection> {
+public:
+    DataStringCollection(const std::string& filename) {
+        _filename = filename;
+    }
+
+    DataStringCollection(size_t count, StringLengthDistribution distribution, size_t minLength, size_t maxLength,
+                         size_t prefixLength, double duplicatesRatio, unsigned int seed, const char* file_path = "") {
+        generate(count, distribution, minLength, maxLength, prefixLength, duplicatesRatio, seed);
+        std::string filename(file_path);
+        if (filename.empty()) {
+            _filename = getCurrentDateTime() + ".strings";
+        } else {
+            _filename = filename;
+        }
+        save(false, 0, 0, _filename);
+        clear();
+    }
+
+    void read() override {
+        if (!_filename.empty()) {
+            load();
+        }
+    }
+
+    void clear() override {
+        _arena.clear();
+        _arena.shrink_to_fit();
+        _offsets.clear();
+        _offsets.shrink_to_fit();
+    }
+
+    MetadataStringCollection& copy() override {
+        clear_copy();
+
+        char* arena = new char[_arena.size()];
+        size_t* offsets = new size_t[_offsets.size()];
+        std::memcpy(arena, _arena.data(), _arena.size());
+        std::memcpy(offsets, _offsets.data(), _offsets.size() * sizeof(size_t));
+
+        _copy = std::make_tuple(arena, offsets, count());
+        return _copy;
+    }
+
+    MetadataStringCollection& restore() override {
+        if (!std::get<0>(_copy)) {
+            return copy();
+        }
+        parallelCopy(std::get<0>(_copy), _arena.data(), _arena.size());
+        parallelCopy(std::get<1>(_copy), _offsets.data(), _offsets.size() * sizeof(size_t));
+        return _copy;
+    }
+
+    MetadataStringCollection& share() override {
+        _view = std::make_tuple(_arena.data(), _offsets.data(), count());
+        return _view;
+    }
+
+    void clear_copy() override {
+        delete[] std::get<0>(_copy);
+        delete[] std::get<1>(_copy);
+        _copy = MetadataStringCollection();
+    }
+
+    const std::string save_copy(const std::string& dirname, int args_id, int thread_num) const override {
+        if (std::get<0>(_copy)) {
+            std::string filename = "proc" + proc_data_str(args_id, thread_num) + "_" + _filename;
+            std::filesystem::path file_path = std::filesystem::path(dirname) / filename;
+            save(true, args_id, thread_num, file_path);
+            return filename;
+        }
+        throw std::runtime_error("Copy data not found");
+    }
+
+    const std::string title() const override {
+        return "Набор из " + std::to_string(count()) + " строк общей длиной " + std::to_string(_arena.size()) + " символов.";
+    }
+
+    const std::string type() const override {
+        return std::string("strings");
+    }
+
+private:
+    static constexpr char alphabet[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+    static constexpr size_t alphabetSize = sizeof(alphabet) - 1;
+
+    std::vector<char> _arena;
+    std::vector<size_t> _offsets;
+
+    size_t count() const {
+        return _offsets.empty() ? 0 : _offsets.size() - 1;
+    }
+
+    static uint64_t nextRandom(uint64_t& state) {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+
+    static double nextUniform(uint64_t& state) {
+        return (nextRandom(state) >> 11) * (1.0 / 9007199254740992.0);
+    }
+
+    static size_t bodyLength(StringLengthDistribution distribution, size_t minLength, size_t maxLength, uint64_t& state) {
+        const double span = double(maxLength - minLength);
+        double length = double(maxLength);
+        switch (distribution) {
+            case StringLengthDistribution::Fixed:
+                break;
+            case StringLengthDistribution::Uniform:
+                length = minLength + std::floor(nextUniform(state) * (span + 1));
+                break;
+            case StringLengthDistribution::Normal: {
+                const double u1 = 1.0 - nextUniform(state), u2 = nextUniform(state);
+                const double z = std::sqrt(-2.0 * std::log(u1)) * std::cos(2.0 * std::acos(-1.0) * u2);
+                length = std::round(minLength + span / 2 + z * span / 6);
+                break;
+            }
+            case StringLengthDistribution::Exponential:
+                length = std::round(minLength - std::log(1.0 - nextUniform(state)) * span / 4);
+                break;
+            default:
+                throw std::invalid_argument("Invalid length distribution");
+        }
+        return static_cast<size_t>(std::clamp(length, double(minLength), double(maxLength)));
+    }
+
+    // Duplicates regenerate the content of their source string from the same per-string seed
+    void generate(size_t count, StringLengthDistribution distribution, size_t minLength, size_t maxLength,
+                  size_t prefixLength, double duplicatesRatio, unsigned int seed) {
+        if (minLength > maxLength) throw std::invalid_argument("Minimum length exceeds maximum length");
+        if (duplicatesRatio < 0.0 || duplicatesRatio >= 1.0) throw std::invalid_argument("Duplicates ratio must be in [0, 1)");
+
+        std::mt19937_64 gen(seed);
+        std::uniform_int_distribution<size_t> symbol(0, alphabetSize - 1);
+        std::string prefix(prefixLength, ' ');
+        for (auto& c : prefix) {
+            c = alphabet[symbol(gen)];
+        }
+
+        const size_t unique = count - static_cast<size_t>(count * duplicatesRatio);
+        std::vector<size_t> source(count);
+        std::iota(source.begin(), source.begin() + unique, size_t(0));
+        if (unique > 0) {
+            std::uniform_int_distribution<size_t> pick(0, unique - 1);
+            for (size_t i = unique; i < count; ++i) {
+                source[i] = pick(gen);
+            }
+        }
+        std::shuffle(source.begin(), source.end(), gen);
+
+        const uint64_t base = gen();
+        std::vector<size_t> lengths(unique);
+        #pragma omp parallel for schedule(static)
+        for (size_t i = 0; i < unique; ++i) {
+            uint64_t state = base ^ (i * 0xD1B54A32D192ED03ULL);
+            lengths[i] = prefixLength + bodyLength(distribution, minLength, maxLength, state);
+        }
+
+        _offsets.assign(count + 1, 0);
+        for (size_t i = 0; i < count; ++i) {
+            _offsets[i + 1] = _offsets[i] + lengths[source[i]];
+        }
+        _arena.resize(_offsets[count]);
+
+        #pragma omp parallel for schedule(static)
+        for (size_t i = 0; i < count; ++i) {
+            uint64_t state = base ^ (source[i] * 0xD1B54A32D192ED03ULL);
+            bodyLength(distribution, minLength, maxLength, state);
+
+            char* out = _arena.data() + _offsets[i];
+            std::memcpy(out, prefix.data(), prefixLength);
+            const size_t length = _offsets[i + 1] - _offsets[i];
+            uint64_t bits = 0;
+            for (size_t j = prefixLength; j < length; ++j) {
+                if ((j - prefixLength) % 10 == 0) {
+                    bits = nextRandom(state);
+                }
+                out[j] = alphabet[bits % alphabetSize];
+                bits /= alphabetSize;
+            }
+        }
+    }
+
+    void save(bool saveCopy, int args_id, int thread_num, const std::string& filename) const override {
+        const char* arena = saveCopy ? std::get<0>(_copy) : _arena.data();
+        const size_t* offsets = saveCopy ? std::get<1>(_copy) : _offsets.data();
+        const size_t strings = count();
+
+        std::vector<char> buffer(_arena.size() + strings);
+        #pragma omp parallel for schedule(static)
+        for (size_t i = 0; i < strings; ++i) {
+            std::memcpy(buffer.data() + offsets[i] + i, arena + offsets[i], offsets[i + 1] - offsets[i]);
+            buffer[offsets[i + 1] + i] = '\n';
+        }
+
+        std::ofstream file(filename, std::ios::binary);
+        if (!file.is_open()) throw std::runtime_error("Cannot open file");
+        file.write(buffer.data(), buffer.size());
+    }
+
+    // Lines end with "\n" or "\r\n", both are dropped; string lengths are summed first so
+    // every line is copied to its arena offset in parallel
+    void load() override {
+        std::string text;
+        std::vector<size_t> lines;
+        readTextFile(_filename, text);
+        buildLineOffsets(text, lines);
+
+        const size_t strings = lines.size() - 1;
+        _offsets.resize(strings + 1);
+        #pragma omp parallel for schedule(static)
+        for (size_t i = 0; i < strings; ++i) {
+            _offsets[i + 1] = lineContentEnd(text, lines[i], lines[i + 1]) - lines[i];
+        }
+        _offsets[0] = 0;
+        std::partial_sum(_offsets.begin(), _offsets.end(), _offsets.begin());
+        _arena.resize(_offsets[strings]);
+
+        #pragma omp parallel for schedule(static)
+        for (size_t i = 0; i < strings; ++i) {
+            std::memcpy(_arena.data() + _offsets[i], text.data() + lines[i], _offsets[i + 1] - _offsets[i]);
+        }
+    }
+};
+
+#endif
@@ -2,30 +2,158 @@
 #define DATA_TEXT_H
 
 #include "Data.h"
+#include <cmath>
+#include <cstring>
 #include <filesystem>
 #include <iostream>
+#include <omp.h>
 #include <stdexcept>
 #include <string>
 #include <tuple>
+#include <unordered_set>
 #include <variant>
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 using MetadataText = std::tuple<char*,  size_t>;
 
-class DataText : public Data<MetadataText> {
+using MetadataTextLines = std::tuple<
+    char*,          // Text
+    size_t,         // Text length
+    const size_t*,  // Line start offsets, lineCount + 1 entries (last is the text length)
+    size_t          // Line count
+>;
+
+inline void readTextFile(const std::string& filename, std::string& data) {
+#if defined(__unix__) || defined(__APPLE__)
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) throw std::runtime_error("Cannot open file");
+
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        close(fd);
+        throw std::runtime_error("Cannot stat file");
+    }
+    const size_t size = static_cast<size_t>(info.st_size);
+    data.resize(size);
+    if (size == 0) {
+        close(fd);
+        return;
+    }
+
+    void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) throw std::runtime_error("Cannot map file");
+    madvise(mapped, size, MADV_SEQUENTIAL);
+
+    const char* source = static_cast<const char*>(mapped);
+    const size_t chunk = 1 << 24;
+    const size_t chunks = (size + chunk - 1) / chunk;
+    #pragma omp parallel for schedule(static)
+    for (size_t i = 0; i < chunks; ++i) {
+        std::memcpy(&data[i * chunk], source + i * chunk, std::min(chunk, size - i * chunk));
+    }
+    munmap(mapped, size);
+#else
+    std::ifstream file(filename, std::ios::binary | std::ios::ate);
+    if (!file.is_open()) throw std::runtime_error("Cannot open file");
+    data.resize(static_cast<size_t>(file.tellg()));
+    file.seekg(0);
+    file.read(data.data(), data.size());
+#endif
+}
+
+inline void buildLineOffsets(const std::string& data, std::vector<size_t>& offsets) {
+    const char* text = data.data();
+    const size_t size = data.size();
+    std::vector<size_t> counts(omp_get_max_threads() + 1, 0);
+
+    #pragma omp parallel
+    {
+        const int thread = omp_get_thread_num();
+        const int threads = omp_get_num_threads();
+        const size_t begin = size * thread / threads;
+        const size_t end = size * (thread + 1) / threads;
+
+        size_t count = 0;
+        for (const char* p = text + begin; (p = static_cast<const char*>(std::memchr(p, '\n', text + end - p))); ++p) {
+            ++count;
+        }
+        counts[thread + 1] = count;
+
+        #pragma omp barrier
+        #pragma omp single
+        {
+            for (int i = 1; i <= threads; ++i) {
+                counts[i] += counts[i - 1];
+            }
+            offsets.assign(counts[threads] + 1, 0);
+        }
+
+        size_t position = counts[thread] + 1;
+        for (const char* p = text + begin; (p = static_cast<const char*>(std::memchr(p, '\n', text + end - p))); ++p) {
+            offsets[position++] = p - text + 1;
+        }
+    }
+
+    if (offsets.back() != size) {
+        offsets.push_back(size);
+    }
+}
+
+// End of the content of the line [begin, end) without its "\n" or "\r\n" terminator
+inline size_t lineContentEnd(const std::string& text, size_t begin, size_t end) {
+    if (end > begin && text[end - 1] == '\n') {
+        --end;
+        if (end > begin && text[end - 1] == '\r') {
+            --end;
+        }
+    }
+    return end;
+}
+
+enum class LineLengthDistribution {
+    Fixed,
+    Uniform,
+    Normal
+};
+
+template <typename Metadata>
+class DataTextBase : public Data<Metadata> {
 public:
-    DataText(const std::string &filename) {
-        _filename = filename;
+    DataTextBase(const std::string &filename) {
+        this->_filename = filename;
     }
 
-    DataText(const std::string& data, const char* file_path) {
+    DataTextBase(const std::string& data, const char* file_path) {
         _data = data;
         std::string filename(file_path);
         if (filename.empty()) {
-            _filename = getCurrentDateTime() + ".txt";
+            this->_filename = this->getCurrentDateTime() + ".txt";
         } else {
-            _filename = filename;
+            this->_filename = filename;
         }
-        save(false, 0, 0, _filename);
+        save(false, 0, 0, this->_filename);
+        clear();
+    }
+
+    DataTextBase(size_t size, size_t vocabularySize, double zipfExponent, LineLengthDistribution lineLength, size_t wordsPerLine, unsigned int seed, const char* file_path = "") {
+        if (vocabularySize == 0 || wordsPerLine == 0) {
+            throw std::invalid_argument("Vocabulary size and words per line must be positive");
+        }
+        generateZipf(size, vocabularySize, zipfExponent, lineLength, wordsPerLine, seed);
+        std::string filename(file_path);
+        if (filename.empty()) {
+            this->_filename = this->getCurrentDateTime() + ".txt";
+        } else {
+            this->_filename = filename;
+        }
+        save(false, 0, 0, this->_filename);
         clear();
     }
 
@@ -40,42 +168,28 @@ public:
         _data.shrink_to_fit();
     }
 
-    MetadataText& copy() override {
-        clear_copy();
-
-        char* copy = new char[_data.size() + 1];
-        std::copy(_data.begin(), _data.end(), copy);
-        copy[_data.size()] = '\0';
-
-        _copy = std::make_tuple(copy, _data.length());
-        return _copy;
+    // The terminating zero written by copy() stays in place
+    Metadata& restore() override {
+        if (!std::get<0>(this->_copy)) {
+            return this->copy();
+        }
+        parallelCopy(std::get<0>(this->_copy), _data.data(), _data.size());
+        return this->_copy;
     }
 
     void clear_copy() override {
-        try {
-            auto data = std::get<0>(_copy);
-            if (data) {
-                delete[] data;
-            }
-        } catch (const std::bad_variant_access& e) {
-            return;
-        }
+        delete[] std::get<0>(this->_copy);
+        std::get<0>(this->_copy) = nullptr;
     }
 
     const std::string save_copy(const std::string& dirname, int args_id, int thread_num) const override {
-        try {
-            auto data = std::get<0>(_copy);
-            if (data) {
-                std::string filename = "proc" + proc_data_str(args_id, thread_num) + " " + _filename;
-                std::filesystem::path file_path = std::filesystem::path(dirname) / filename;
-                save(true, args_id, thread_num, file_path);
-                return filename;
-            } else {
-                throw std::runtime_error("Copy data not found");
-            }
-        } catch (const std::bad_variant_access& e) {
-            throw std::runtime_error("Copy data not found");
+        if (std::get<0>(this->_copy)) {
+            std::string filename = "proc" + this->proc_data_str(args_id, thread_num) + " " + this->_filename;
+            std::filesystem::path file_path = std::filesystem::path(dirname) / filename;
+            save(true, args_id, thread_num, file_path);
+            return filename;
         }
+        throw std::runtime_error("Copy data not found");
     }
 
     const std::string title() const override {
@@ -85,37 +199,155 @@ public:
     const std::string type() const override {
         return std::string("text");
     }
-    
-private:
+
+protected:
     std::string _data;
-    
-    void save(bool saveCopy, int args_id, int thread_num, const std::string &filename) const override {
-        std::string data;
-        if (saveCopy) {
-            data = std::string(std::get<0>(_copy));
-        } else {
-            data = _data;
+
+    void generateZipf(size_t size, size_t vocabularySize, double zipfExponent, LineLengthDistribution lineLength, size_t wordsPerLine, unsigned int seed) {
+        std::mt19937_64 gen(seed);
+
+        // Shorter words get the lower (more frequent) ranks, as in natural text
+        std::vector<std::string> vocabulary;
+        vocabulary.reserve(vocabularySize);
+        std::unordered_set<std::string> unique;
+        std::geometric_distribution<size_t> extraLength(0.3);
+        std::uniform_int_distribution<int> letter('a', 'z');
+        const size_t minLength = static_cast<size_t>(std::ceil(std::log(double(vocabularySize) + 1) / std::log(26.0)));
+        while (vocabulary.size() < vocabularySize) {
+            std::string word(std::max<size_t>(1, minLength) + extraLength(gen), ' ');
+            for (auto& c : word) {
+                c = static_cast<char>(letter(gen));
+            }
+            if (unique.insert(word).second) {
+                vocabulary.push_back(std::move(word));
+            }
+        }
+        std::stable_sort(vocabulary.begin(), vocabulary.end(), [](const std::string& a, const std::string& b) { return a.size() < b.size(); });
+
+        std::vector<double> cdf(vocabularySize);
+        double sum = 0.0;
+        for (size_t rank = 0; rank < vocabularySize; ++rank) {
+            sum += 1.0 / std::pow(double(rank + 1), zipfExponent);
+            cdf[rank] = sum;
         }
-        
-        std::ofstream file(filename);
-        if (file.is_open()) {
-            file << data;
+        for (auto& value : cdf) {
+            value /= sum;
         }
-        else throw std::runtime_error("Cannot open file");
-        file.close();
-    }
 
-    void load() override {
-        std::ifstream file(_filename);
-        if (file.is_open()) {
-            std::string newStr;
-            while (std::getline(file, newStr)) {
-                _data += newStr + '\n';
+        const size_t blockSize = 1 << 20;
+        const size_t blocks = (size + blockSize - 1) / blockSize;
+        std::vector<std::string> parts(blocks);
+
+        #pragma omp parallel for schedule(dynamic, 1)
+        for (size_t block = 0; block < blocks; ++block) {
+            std::mt19937_64 blockGen(seed ^ (0x9E3779B97F4A7C15ULL * (block + 1)));
+            std::uniform_real_distribution<double> uniform(0.0, 1.0);
+            std::uniform_int_distribution<size_t> uniformWords(1, 2 * wordsPerLine - 1);
+            std::normal_distribution<double> normalWords{double(wordsPerLine), double(wordsPerLine) / 4.0};
+
+            const size_t quota = std::min(blockSize, size - block * blockSize);
+            std::string& part = parts[block];
+            part.reserve(quota + 256);
+            while (part.size() < quota) {
+                size_t words = wordsPerLine;
+                if (lineLength == LineLengthDistribution::Uniform) {
+                    words = uniformWords(blockGen);
+                } else if (lineLength == LineLengthDistribution::Normal) {
+                    words = static_cast<size_t>(std::max(1.0, std::round(normalWords(blockGen))));
+                }
+                for (size_t w = 0; w < words; ++w) {
+                    size_t rank = std::lower_bound(cdf.begin(), cdf.end(), uniform(blockGen)) - cdf.begin();
+                    part += vocabulary[std::min(rank, vocabularySize - 1)];
+                    part += (w + 1 == words) ? '\n' : ' ';
+                }
             }
         }
-        else throw std::runtime_error("Cannot open file");
-        file.close();
+
+        std::vector<size_t> offsets(blocks + 1, 0);
+        for (size_t block = 0; block < blocks; ++block) {
+            offsets[block + 1] = offsets[block] + parts[block].size();
+        }
+        _data.resize(offsets[blocks]);
+        #pragma omp parallel for schedule(static)
+        for (size_t block = 0; block < blocks; ++block) {
+            std::memcpy(&_data[offsets[block]], parts[block].data(), parts[block].size());
+        }
+        _data.resize(size);
+        if (size > 0) {
+            _data.back() = '\n';
+        }
+    }
+
+    char* copyText() const {
+        char* copy = new char[_data.size() + 1];
+        std::copy(_data.begin(), _data.end(), copy);
+        copy[_data.size()] = '\0';
+        return copy;
+    }
+
+    void save(bool saveCopy, int args_id, int thread_num, const std::string &filename) const override {
+        const char* data = saveCopy ? std::get<0>(this->_copy) : _data.data();
+        const size_t size = saveCopy ? std::get<1>(this->_copy) : _data.size();
+
+        std::ofstream file(filename, std::ios::binary);
+        if (!file.is_open()) throw std::runtime_error("Cannot open file");
+        file.write(data, size);
+    }
+
+    void load() override {
+        readTextFile(this->_filename, _data);
+    }
+};
+
+class DataText : public DataTextBase<MetadataText> {
+public:
+    using DataTextBase::DataTextBase;
+
+    MetadataText& copy() override {
+        clear_copy();
+        _copy = std::make_tuple(copyText(), _data.length());
+        return _copy;
+    }
+
+    MetadataText& share() override {
+        _view = std::make_tuple(_data.data(), _data.length());
+        return _view;
+    }
+};
+
+class DataTextLines : public DataTextBase<MetadataTextLines> {
+public:
+    using DataTextBase::DataTextBase;
+
+    void clear() override {
+        DataTextBase::clear();
+        _lineOffsets.clear();
+        _lineOffsets.shrink_to_fit();
+    }
+
+    MetadataTextLines& copy() override {
+        clear_copy();
+        _copy = std::make_tuple(copyText(), _data.length(), _lineOffsets.data(), lineCount());
+        return _copy;
+    }
+
+    MetadataTextLines& share() override {
+        _view = std::make_tuple(_data.data(), _data.length(), _lineOffsets.data(), lineCount());
+        return _view;
+    }
+
+private:
+    std::vector<size_t> _lineOffsets;
+
+    // Offsets hold one entry past the last line; before read() there are none
+    size_t lineCount() const {
+        return _lineOffsets.empty() ? 0 : _lineOffsets.size() - 1;
+    }
+
+    void load() override {
+        DataTextBase::load();
+        buildLineOffsets(_data, _lineOffsets);
     }
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -2,6 +2,7 @@
 #define DATA_VIDEO_H
 
 #include "Data.h"
+#include "MediaCache.h"
 #include <libavutil/opt.h>
 #include <vector>
 #include <memory>
@@ -9,6 +10,20 @@
 #include <functional>
 #include <stdexcept>
 #include <iostream>
+#include <algorithm>
+#include <mutex>
+#include <list>
+#include <unordered_map>
+#include <map>
+#include <fstream>
+#include <limits>
+#include <atomic>
+#include <exception>
+#include <omp.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
 
 extern "C" {
 #include <libavcodec/avcodec.h>
@@ -21,39 +36,120 @@ extern "C" {
 
 class DataVideo;
 
+// Packed RGB24 frame in one aligned block, rows are stride() bytes apart. Frames are
+// move-only and commit themselves once, on destruction, if they were written to.
+// Writes through at(), row() and data() mark the frame modified; reading a pixel through
+// at() and the c_ accessors never do.
 class VideoFrameBuffer {
+    friend class DataVideo;
 private:
     DataVideo* parent;
     size_t frame_index;
     bool modified;
-    std::vector<std::vector<uint8_t>> frame_data;
     size_t width;
     size_t height;
+    AlignedBuffer frame_data;
+    size_t frame_stride;
+    // Borrowed read-only frame, copied into frame_data on the first write
+    const uint8_t* view = nullptr;
+
+    VideoFrameBuffer(DataVideo* p, size_t idx, size_t w, size_t h, const uint8_t* data, size_t stride);
+
+    // Row of the owned block for filling by DataVideo, does not mark the frame modified
+    uint8_t* fill_row(size_t y) { return frame_data.data() + y * frame_stride; }
+
+    uint8_t* writable() {
+        if (view) materialize();
+        modified = true;
+        return frame_data.data();
+    }
+
+    void materialize() {
+        const uint8_t* source = view;
+        const size_t source_stride = frame_stride;
+        frame_stride = alignedSize(width * 3);
+        frame_data.resize(frame_stride * height);
+        for (size_t y = 0; y < height; ++y) {
+            std::memcpy(fill_row(y), source + y * source_stride, width * 3);
+        }
+        view = nullptr;
+    }
 
 public:
+    // Reference to one channel value: reading converts to uint8_t, assignment marks the frame modified
+    class Pixel {
+    public:
+        Pixel(VideoFrameBuffer& frame, size_t offset) : frame(frame), offset(offset) {}
+
+        operator uint8_t() const { return frame.c_data()[offset]; }
+        Pixel& operator=(uint8_t value) {
+            frame.writable()[offset] = value;
+            return *this;
+        }
+        Pixel& operator=(const Pixel& other) { return *this = static_cast<uint8_t>(other); }
+        Pixel& operator+=(int value) { return *this = static_cast<uint8_t>(*this + value); }
+        Pixel& operator-=(int value) { return *this = static_cast<uint8_t>(*this - value); }
+
+    private:
+        VideoFrameBuffer& frame;
+        size_t offset;
+    };
+
     VideoFrameBuffer() = delete;
     VideoFrameBuffer(DataVideo* p, size_t idx, size_t w, size_t h);
-    VideoFrameBuffer(const VideoFrameBuffer&) = default;
-    VideoFrameBuffer(VideoFrameBuffer&&) = default;
+    VideoFrameBuffer(const VideoFrameBuffer&) = delete;
+    VideoFrameBuffer& operator=(const VideoFrameBuffer&) = delete;
+
+    VideoFrameBuffer(VideoFrameBuffer&& other) noexcept :
+        parent(other.parent), frame_index(other.frame_index), modified(other.modified),
+        width(other.width), height(other.height),
+        frame_data(std::move(other.frame_data)), frame_stride(other.frame_stride), view(other.view) {
+        other.modified = false;
+    }
+
+    VideoFrameBuffer& operator=(VideoFrameBuffer&& other) {
+        if (this != &other) {
+            commit();
+            parent = other.parent;
+            frame_index = other.frame_index;
+            modified = other.modified;
+            width = other.width;
+            height = other.height;
+            frame_data = std::move(other.frame_data);
+            frame_stride = other.frame_stride;
+            view = other.view;
+            other.modified = false;
+        }
+        return *this;
+    }
+
     ~VideoFrameBuffer() {
         commit();
     }
 
-    uint8_t& at(size_t row, size_t col, size_t channel) {
-        modified = true;
-        return frame_data[row][col * 3 + channel];
+    Pixel at(size_t row, size_t col, size_t channel) {
+        return Pixel(*this, row * frame_stride + col * 3 + channel);
     }
 
     const uint8_t& c_at(size_t row, size_t col, size_t channel) const {
-        return frame_data[row][col * 3 + channel];
+        return c_data()[row * frame_stride + col * 3 + channel];
     }
 
+    uint8_t* row(size_t y) { return writable() + y * frame_stride; }
+    const uint8_t* c_row(size_t y) const { return c_data() + y * frame_stride; }
+
+    uint8_t* data() { return writable(); }
+    const uint8_t* c_data() const { return view ? view : frame_data.data(); }
+
+    size_t stride() const { return frame_stride; }
+
     void mark_unmodified() { modified = false; }
 
     void commit();
 };
 
 class AudioFrameBuffer {
+    friend class DataVideo;
 private:
     DataVideo* parent;
     size_t frame_index;
@@ -85,8 +181,57 @@ public:
     void commit();
 };
 
-using VideoFrame = std::function<VideoFrameBuffer(size_t)>;
-using AudioFrame = std::function<AudioFrameBuffer(size_t)>;
+// Read-only packed RGB24 frame owned by a VideoFrameStream, rows are stride bytes apart
+struct VideoFrameView {
+    size_t index = 0;
+    size_t width = 0;
+    size_t height = 0;
+    size_t stride = 0;
+    const uint8_t* data = nullptr;
+
+    const uint8_t* row(size_t y) const { return data + y * stride; }
+    const uint8_t& at(size_t row, size_t col, size_t channel) const { return data[row * stride + col * 3 + channel]; }
+};
+
+// Frames decoded ahead by a background thread; a view stays valid until the next frame is requested
+using VideoFrameStream = PrefetchStream<VideoFrameView>;
+
+// Random-access loader of the copy; stream() adds sequential access with decode prefetch
+class VideoFrame {
+public:
+    VideoFrame() = default;
+    explicit VideoFrame(DataVideo* video) : video(video) {}
+
+    VideoFrameBuffer operator()(size_t index) const;
+
+    // Frames [first, first + count) in order, count 0 streams to the last frame.
+    // depth is the number of frames decoded ahead and bounds the ring memory.
+    VideoFrameStream stream(size_t first = 0, size_t count = 0, size_t depth = 4) const;
+
+    explicit operator bool() const { return video != nullptr; }
+
+private:
+    DataVideo* video = nullptr;
+};
+
+// Random-access loader of audio packets; read_samples() addresses the track by sample
+class AudioFrame {
+public:
+    AudioFrame() = default;
+    explicit AudioFrame(DataVideo* video) : video(video) {}
+
+    AudioFrameBuffer operator()(size_t index) const;
+
+    // Interleaved float samples [start, start + count) of every channel
+    std::vector<float> read_samples(size_t start, size_t count) const;
+
+    size_t sample_count() const;
+
+    explicit operator bool() const { return video != nullptr; }
+
+private:
+    DataVideo* video = nullptr;
+};
 using MetadataVideo = std::tuple<
     VideoFrame,
     AudioFrame,
@@ -98,6 +243,536 @@ using MetadataVideo = std::tuple<
     int         // Channel count
 >;
 
+enum class VideoStorage {
+    RGB24,
+    YUV420
+};
+
+// Decodes a frame range once in read(), so the loader serves frames without decoding.
+// Frame indices passed to the loader are relative to first_frame.
+struct VideoPreload {
+    size_t first_frame = 0;
+    size_t frame_count = 0;                         // 0 loads every frame from first_frame on
+    VideoStorage storage = VideoStorage::RGB24;     // YUV420 halves the footprint, frames are converted on access
+    size_t memory_budget = 0;                       // 0 allows up to half of the physical memory
+    int decode_threads = 0;                         // GOP decoders working in parallel, 0 uses the OpenMP default
+};
+
+// Keeps the demuxer, decoder and scaler of one video stream open between reads.
+// Frames are addressed in presentation order through the timestamp index of DataVideo:
+// a read continues decoding when the target lies ahead in the current GOP and
+// otherwise seeks to the nearest preceding keyframe.
+class VideoDecoder {
+private:
+    std::string filename;
+    int stream_index;
+    AVFormatContext* fmt_ctx = nullptr;
+    AVCodecContext* codec_ctx = nullptr;
+    SwsContext* sws_ctx = nullptr;
+    AVPacket* pkt = nullptr;
+    AVFrame* frame = nullptr;
+    std::vector<uint8_t> rgb_buffer;
+    size_t next_index = 0;
+    bool draining = false;
+
+    void close() {
+        if (sws_ctx) sws_freeContext(sws_ctx);
+        sws_ctx = nullptr;
+        if (frame) av_frame_free(&frame);
+        if (pkt) av_packet_free(&pkt);
+        if (codec_ctx) avcodec_free_context(&codec_ctx);
+        if (fmt_ctx) avformat_close_input(&fmt_ctx);
+    }
+
+    void seek(size_t keyframe, const std::vector<int64_t>& timestamps) {
+        if (av_seek_frame(fmt_ctx, stream_index, timestamps[keyframe], AVSEEK_FLAG_BACKWARD) < 0) {
+            throw std::runtime_error("Cannot seek to keyframe " + std::to_string(keyframe));
+        }
+        avcodec_flush_buffers(codec_ctx);
+        next_index = keyframe;
+        draining = false;
+    }
+
+public:
+    // threads is the FFmpeg frame/slice thread count for this decoder, 0 picks one per core
+    VideoDecoder(const std::string& file, int stream, int threads = 0) : filename(file), stream_index(stream) {
+        try {
+            if (avformat_open_input(&fmt_ctx, filename.c_str(), nullptr, nullptr) != 0) {
+                throw std::runtime_error("Cannot open input file");
+            }
+            if (avformat_find_stream_info(fmt_ctx, nullptr) < 0) {
+                throw std::runtime_error("Cannot find stream information");
+            }
+            if (stream_index < 0 || static_cast<unsigned>(stream_index) >= fmt_ctx->nb_streams) {
+                throw std::runtime_error("No video stream found");
+            }
+
+            AVStream* video_stream = fmt_ctx->streams[stream_index];
+            const AVCodec* codec = avcodec_find_decoder(video_stream->codecpar->codec_id);
+            if (!codec) {
+                throw std::runtime_error("Unsupported codec");
+            }
+            codec_ctx = avcodec_alloc_context3(codec);
+            if (!codec_ctx) {
+                throw std::runtime_error("Cannot allocate codec context");
+            }
+            if (avcodec_parameters_to_context(codec_ctx, video_stream->codecpar) < 0) {
+                throw std::runtime_error("Cannot copy codec parameters");
+            }
+            codec_ctx->thread_count = threads;
+            codec_ctx->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+            if (avcodec_open2(codec_ctx, codec, nullptr) < 0) {
+                throw std::runtime_error("Cannot open codec");
+            }
+
+            pkt = av_packet_alloc();
+            frame = av_frame_alloc();
+            if (!pkt || !frame) {
+                throw std::runtime_error("Cannot allocate decoder buffers");
+            }
+        }
+        catch (...) {
+            close();
+            throw;
+        }
+    }
+
+    VideoDecoder(const VideoDecoder&) = delete;
+    VideoDecoder& operator=(const VideoDecoder&) = delete;
+
+    ~VideoDecoder() {
+        close();
+    }
+
+    const std::string& source() const { return filename; }
+    // Frame the next read continues from without seeking
+    size_t position() const { return next_index; }
+
+    // Returns the frame as packed RGB24 rows of width * 3 bytes, valid until the next read
+    const uint8_t* read(size_t index, const std::vector<int64_t>& timestamps, const std::vector<size_t>& keyframes,
+                        size_t width, size_t height) {
+        rgb_buffer.resize(width * height * 3);
+        uint8_t* dest[4] = {rgb_buffer.data(), nullptr, nullptr, nullptr};
+        int dest_linesize[4] = {static_cast<int>(width * 3), 0, 0, 0};
+        read(index, timestamps, keyframes, width, height, AV_PIX_FMT_RGB24, dest, dest_linesize);
+        return rgb_buffer.data();
+    }
+
+    // Converts the frame into caller-owned planes of the given pixel format
+    void read(size_t index, const std::vector<int64_t>& timestamps, const std::vector<size_t>& keyframes,
+              size_t width, size_t height, AVPixelFormat format, uint8_t* const dest[4], const int dest_linesize[4]) {
+        const size_t keyframe = *(std::upper_bound(keyframes.begin(), keyframes.end(), index) - 1);
+        if (index < next_index || keyframe > next_index) {
+            seek(keyframe, timestamps);
+        }
+
+        while (true) {
+            int ret = avcodec_receive_frame(codec_ctx, frame);
+            if (ret == 0) {
+                const int64_t pts = frame->best_effort_timestamp != AV_NOPTS_VALUE ? frame->best_effort_timestamp : frame->pts;
+                const size_t current = std::lower_bound(timestamps.begin(), timestamps.end(), pts) - timestamps.begin();
+                if (current < index) {
+                    av_frame_unref(frame);
+                    continue;
+                }
+
+                sws_ctx = sws_getCachedContext(sws_ctx,
+                    frame->width, frame->height, static_cast<AVPixelFormat>(frame->format),
+                    width, height, format,
+                    SWS_BILINEAR, nullptr, nullptr, nullptr);
+                if (!sws_ctx) {
+                    throw std::runtime_error("Cannot create sws context");
+                }
+                sws_scale(sws_ctx, frame->data, frame->linesize, 0, frame->height, dest, dest_linesize);
+
+                av_frame_unref(frame);
+                next_index = current + 1;
+                return;
+            }
+            if (ret == AVERROR_EOF) {
+                next_index = timestamps.size();
+                throw std::runtime_error("Cannot decode frame " + std::to_string(index));
+            }
+            if (ret != AVERROR(EAGAIN)) {
+                throw std::runtime_error("Error during decoding");
+            }
+
+            if (draining) {
+                throw std::runtime_error("Cannot decode frame " + std::to_string(index));
+            }
+            if (av_read_frame(fmt_ctx, pkt) < 0) {
+                avcodec_send_packet(codec_ctx, nullptr);
+                draining = true;
+                continue;
+            }
+            if (pkt->stream_index == stream_index) {
+                avcodec_send_packet(codec_ctx, pkt);
+            }
+            av_packet_unref(pkt);
+        }
+    }
+};
+
+// Keeps the demuxer, decoder and resampler of one audio stream open between reads and
+// produces interleaved float samples. A read continues decoding when the range starts
+// at or after the decoded position within the next packet, otherwise it seeks to the
+// packet holding the first requested sample.
+class AudioDecoder {
+private:
+    std::string filename;
+    int stream_index;
+    int sample_rate;
+    int channels;
+    AVFormatContext* fmt_ctx = nullptr;
+    AVCodecContext* codec_ctx = nullptr;
+    SwrContext* swr_ctx = nullptr;
+    AVPacket* pkt = nullptr;
+    AVFrame* frame = nullptr;
+    std::vector<float> pending;     // Converted samples of the last frame
+    size_t position = 0;            // Track sample at the start of pending
+    size_t next_packet = 0;
+    bool draining = false;
+
+    void close() {
+        if (swr_ctx) swr_free(&swr_ctx);
+        if (frame) av_frame_free(&frame);
+        if (pkt) av_packet_free(&pkt);
+        if (codec_ctx) avcodec_free_context(&codec_ctx);
+        if (fmt_ctx) avformat_close_input(&fmt_ctx);
+    }
+
+    void seek(size_t packet, const std::vector<int64_t>& timestamps, const std::vector<size_t>& offsets) {
+        if (av_seek_frame(fmt_ctx, stream_index, timestamps[packet], AVSEEK_FLAG_BACKWARD) < 0) {
+            throw std::runtime_error("Cannot seek to audio packet " + std::to_string(packet));
+        }
+        avcodec_flush_buffers(codec_ctx);
+        if (swr_ctx) swr_free(&swr_ctx);
+        pending.clear();
+        position = offsets[packet];
+        next_packet = packet;
+        draining = false;
+    }
+
+    // Decodes the next frame into pending; returns false at the end of the stream
+    bool decode_frame(const std::vector<int64_t>& timestamps, const std::vector<size_t>& offsets) {
+        while (true) {
+            int ret = avcodec_receive_frame(codec_ctx, frame);
+            if (ret == 0) {
+                if (!swr_ctx) {
+                    AVChannelLayout out_layout;
+                    av_channel_layout_default(&out_layout, channels);
+                    ret = swr_alloc_set_opts2(&swr_ctx,
+                                              &out_layout, AV_SAMPLE_FMT_FLT, sample_rate,
+                                              &frame->ch_layout, static_cast<AVSampleFormat>(frame->format), frame->sample_rate,
+                                              0, nullptr);
+                    av_channel_layout_uninit(&out_layout);
+                    if (ret < 0 || !swr_ctx || swr_init(swr_ctx) < 0) {
+                        throw std::runtime_error("Cannot create swr context");
+                    }
+                }
+
+                size_t start = position + pending.size() / channels;
+                if (frame->pts != AV_NOPTS_VALUE) {
+                    const size_t packet = std::lower_bound(timestamps.begin(), timestamps.end(), frame->pts) - timestamps.begin();
+                    start = offsets[std::min(packet, timestamps.size())];
+                    next_packet = packet + 1;
+                }
+
+                pending.resize(static_cast<size_t>(swr_get_out_samples(swr_ctx, frame->nb_samples)) * channels);
+                uint8_t* out[1] = {reinterpret_cast<uint8_t*>(pending.data())};
+                const int converted = swr_convert(swr_ctx, out, pending.size() / channels,
+                                                  const_cast<const uint8_t**>(frame->extended_data), frame->nb_samples);
+                av_frame_unref(frame);
+                if (converted < 0) {
+                    throw std::runtime_error("Failed to convert audio samples");
+                }
+                pending.resize(static_cast<size_t>(converted) * channels);
+                position = start;
+                return true;
+            }
+            if (ret == AVERROR_EOF) {
+                return false;
+            }
+            if (ret != AVERROR(EAGAIN)) {
+                throw std::runtime_error("Error during audio decoding");
+            }
+
+            if (draining) {
+                return false;
+            }
+            if (av_read_frame(fmt_ctx, pkt) < 0) {
+                avcodec_send_packet(codec_ctx, nullptr);
+                draining = true;
+                continue;
+            }
+            if (pkt->stream_index == stream_index) {
+                avcodec_send_packet(codec_ctx, pkt);
+            }
+            av_packet_unref(pkt);
+        }
+    }
+
+public:
+    // Samples are converted to the given rate and channel count, normally those of the stream
+    AudioDecoder(const std::string& file, int stream, int sample_rate, int channels) :
+        filename(file), stream_index(stream), sample_rate(sample_rate), channels(channels) {
+        try {
+            if (avformat_open_input(&fmt_ctx, filename.c_str(), nullptr, nullptr) != 0) {
+                throw std::runtime_error("Cannot open input file");
+            }
+            if (avformat_find_stream_info(fmt_ctx, nullptr) < 0) {
+                throw std::runtime_error("Cannot find stream information");
+            }
+            if (stream_index < 0 || static_cast<unsigned>(stream_index) >= fmt_ctx->nb_streams ||
+                fmt_ctx->streams[stream_index]->codecpar->codec_type != AVMEDIA_TYPE_AUDIO) {
+                throw std::runtime_error("No audio stream found");
+            }
+
+            AVStream* audio_stream = fmt_ctx->streams[stream_index];
+            const AVCodec* codec = avcodec_find_decoder(audio_stream->codecpar->codec_id);
+            if (!codec) {
+                throw std::runtime_error("Unsupported audio codec");
+            }
+            codec_ctx = avcodec_alloc_context3(codec);
+            if (!codec_ctx) {
+                throw std::runtime_error("Cannot allocate audio codec context");
+            }
+            if (avcodec_parameters_to_context(codec_ctx, audio_stream->codecpar) < 0) {
+                throw std::runtime_error("Cannot copy audio codec parameters");
+            }
+            if (avcodec_open2(codec_ctx, codec, nullptr) < 0) {
+                throw std::runtime_error("Cannot open audio codec");
+            }
+
+            pkt = av_packet_alloc();
+            frame = av_frame_alloc();
+            if (!pkt || !frame) {
+                throw std::runtime_error("Cannot allocate decoder buffers");
+            }
+        }
+        catch (...) {
+            close();
+            throw;
+        }
+    }
+
+    AudioDecoder(const AudioDecoder&) = delete;
+    AudioDecoder& operator=(const AudioDecoder&) = delete;
+
+    ~AudioDecoder() {
+        close();
+    }
+
+    const std::string& source() const { return filename; }
+
+    // Writes samples [start, start + count) interleaved into out. offsets holds the first
+    // sample of every packet; gaps between decoded frames are filled with silence.
+    void read(size_t start, size_t count, const std::vector<int64_t>& timestamps, const std::vector<size_t>& offsets, float* out) {
+        const size_t packet = std::upper_bound(offsets.begin(), offsets.end(), start) - offsets.begin() - 1;
+        if (start < position || packet > next_packet) {
+            seek(std::min(packet, timestamps.size() - 1), timestamps, offsets);
+        }
+
+        size_t done = 0;
+        while (done < count) {
+            const size_t target = start + done;
+            const size_t available = pending.size() / channels;
+            if (target < position) {
+                const size_t silence = std::min(count - done, position - target);
+                std::fill(out + done * channels, out + (done + silence) * channels, 0.0f);
+                done += silence;
+            } else if (target < position + available) {
+                const size_t copied = std::min(count - done, position + available - target);
+                std::memcpy(out + done * channels, pending.data() + (target - position) * channels, copied * channels * sizeof(float));
+                done += copied;
+            } else if (!decode_frame(timestamps, offsets)) {
+                throw std::runtime_error("Cannot decode audio sample " + std::to_string(target));
+            }
+        }
+    }
+};
+
+// LRU cache of decoded RGB frames bounded by a byte budget. Lookups and inserts take a
+// short lock of their own, so hits are served while another thread is decoding.
+class FrameCache {
+public:
+    using Frame = std::shared_ptr<const std::vector<uint8_t>>;
+
+    explicit FrameCache(size_t budget = 0) : budget(budget) {}
+    FrameCache(const FrameCache& other) : budget(other.budget) {}
+    FrameCache& operator=(const FrameCache& other) {
+        std::lock_guard<std::mutex> lock(mutex);
+        budget = other.budget;
+        entries.clear();
+        positions.clear();
+        used = 0;
+        return *this;
+    }
+
+    bool enabled() const { return budget > 0; }
+
+    Frame find(size_t index) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = positions.find(index);
+        if (it == positions.end()) {
+            ++misses;
+            return nullptr;
+        }
+        ++hits;
+        entries.splice(entries.begin(), entries, it->second);
+        return it->second->second;
+    }
+
+    void insert(size_t index, Frame frame) {
+        if (frame->size() > budget) return;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (positions.count(index)) return;
+        while (used + frame->size() > budget) {
+            used -= entries.back().second->size();
+            positions.erase(entries.back().first);
+            entries.pop_back();
+            ++evictions;
+        }
+        used += frame->size();
+        entries.emplace_front(index, std::move(frame));
+        positions[index] = entries.begin();
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> lock(mutex);
+        entries.clear();
+        positions.clear();
+        used = 0;
+    }
+
+    std::map<std::string, size_t> statistics() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return {{"frame_cache_hits", hits}, {"frame_cache_misses", misses}, {"frame_cache_evictions", evictions}, {"frame_cache_bytes", used}};
+    }
+
+    void reset_statistics() {
+        std::lock_guard<std::mutex> lock(mutex);
+        hits = misses = evictions = 0;
+    }
+
+private:
+    size_t budget;
+    size_t used = 0;
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t evictions = 0;
+    std::list<std::pair<size_t, Frame>> entries;
+    std::unordered_map<size_t, std::list<std::pair<size_t, Frame>>::iterator> positions;
+    mutable std::mutex mutex;
+};
+
+// Modified frames of the copy. They outlive flush(), so reads keep returning them while
+// the copy holds a re-encoded version. Frames stay in memory up to the byte budget;
+// further ones are appended to a spill file in the temporary directory.
+class DirtyFrameStore {
+public:
+    explicit DirtyFrameStore(size_t budget = 0) : budget(budget) {}
+    DirtyFrameStore(const DirtyFrameStore& other) : budget(other.budget) {}
+    DirtyFrameStore& operator=(const DirtyFrameStore& other) {
+        clear();
+        budget = other.budget;
+        return *this;
+    }
+
+    ~DirtyFrameStore() {
+        clear();
+    }
+
+    // Stores rows of row_bytes each, stride bytes apart in data
+    void put(size_t index, const uint8_t* data, size_t stride, size_t row_bytes, size_t rows) {
+        std::lock_guard<std::mutex> lock(mutex);
+        Entry& entry = frames[index];
+        const size_t bytes = row_bytes * rows;
+
+        if (!entry.data.empty() || memory + bytes <= budget) {
+            if (entry.data.empty()) {
+                memory += bytes;
+                entry.data.resize(bytes);
+            }
+            for (size_t y = 0; y < rows; ++y) {
+                std::memcpy(entry.data.data() + y * row_bytes, data + y * stride, row_bytes);
+            }
+            entry.spill_offset = -1;
+            return;
+        }
+
+        if (!spill.is_open()) {
+            spill_filename = (std::filesystem::temp_directory_path() /
+                ("video_dirty_" + std::to_string(std::time(nullptr)) + "_" + std::to_string(reinterpret_cast<uintptr_t>(this)))).string();
+            spill.open(spill_filename, std::ios::binary | std::ios::in | std::ios::out | std::ios::trunc);
+            if (!spill.is_open()) {
+                throw std::runtime_error("Failed to create spill file for modified frames");
+            }
+        }
+        spill.seekp(0, std::ios::end);
+        entry.spill_offset = spill.tellp();
+        for (size_t y = 0; y < rows; ++y) {
+            spill.write(reinterpret_cast<const char*>(data + y * stride), row_bytes);
+        }
+        if (!spill) {
+            throw std::runtime_error("Failed to spill modified frame");
+        }
+    }
+
+    // Copies a modified frame into rows stride bytes apart, returns false for frames that were not modified
+    bool get(size_t index, uint8_t* data, size_t stride, size_t row_bytes, size_t rows) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = frames.find(index);
+        if (it == frames.end()) {
+            return false;
+        }
+        if (it->second.spill_offset >= 0) {
+            spill.seekg(it->second.spill_offset);
+        }
+        for (size_t y = 0; y < rows; ++y) {
+            if (it->second.spill_offset < 0) {
+                std::memcpy(data + y * stride, it->second.data.data() + y * row_bytes, row_bytes);
+            } else {
+                spill.read(reinterpret_cast<char*>(data + y * stride), row_bytes);
+            }
+        }
+        if (it->second.spill_offset >= 0 && !spill) {
+            throw std::runtime_error("Failed to read spilled frame");
+        }
+        return true;
+    }
+
+    size_t size() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return frames.size();
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> lock(mutex);
+        frames.clear();
+        memory = 0;
+        if (spill.is_open()) {
+            spill.close();
+            std::error_code ec;
+            std::filesystem::remove(spill_filename, ec);
+        }
+    }
+
+private:
+    struct Entry {
+        std::vector<uint8_t> data;
+        std::streamoff spill_offset = -1;
+    };
+
+    size_t budget;
+    size_t memory = 0;
+    std::map<size_t, Entry> frames;
+    std::string spill_filename;
+    mutable std::fstream spill;
+    mutable std::mutex mutex;
+};
+
 class DataVideo : public Data<MetadataVideo> {
 private:
     struct StreamInfo {
@@ -115,9 +790,266 @@ private:
     size_t video_frame_count;
     size_t audio_frame_count;
     
+    int video_stream_index = -1;
+    int audio_stream_index = -1;
+
     std::vector<int64_t> video_positions;
+    std::vector<int64_t> video_timestamps;  // Presentation timestamps in frame order
+    std::vector<size_t> video_keyframes;    // Frame indices of keyframes, always starting at 0
     std::vector<int64_t> audio_positions;
-    std::vector<size_t> audio_sample_counts;
+    std::vector<int64_t> audio_timestamps;      // Packet timestamps in file order
+    std::vector<size_t> audio_sample_counts;    // Samples per packet
+    std::vector<size_t> audio_sample_offsets;   // First sample of every packet, count + 1 entries
+
+    // Decoder state is per object: copies of DataVideo start without an open decoder
+    template <typename Decoder>
+    struct DecoderHandle {
+        std::unique_ptr<Decoder> decoder;
+        std::mutex mutex;
+
+        DecoderHandle() = default;
+        DecoderHandle(const DecoderHandle&) {}
+        DecoderHandle& operator=(const DecoderHandle&) { return *this; }
+    };
+
+    // Video misses borrow a decoder each, so parallel readers missing on different frames
+    // decode concurrently; the pool grows to the number of concurrent misses
+    struct VideoDecoderPool {
+        std::vector<std::unique_ptr<VideoDecoder>> idle;
+        size_t busy = 0;
+        std::mutex mutex;
+
+        VideoDecoderPool() = default;
+        VideoDecoderPool(const VideoDecoderPool&) {}
+        VideoDecoderPool& operator=(const VideoDecoderPool&) { return *this; }
+
+        // Prefers the decoder that reaches index with the least decoding; decoders opened
+        // while others are busy run single-threaded to avoid oversubscription
+        std::unique_ptr<VideoDecoder> acquire(const std::string& source, int stream, size_t index) {
+            std::unique_lock<std::mutex> lock(mutex);
+            idle.erase(std::remove_if(idle.begin(), idle.end(), [&](const std::unique_ptr<VideoDecoder>& decoder) {
+                return decoder->source() != source;
+            }), idle.end());
+
+            size_t best = idle.size();
+            for (size_t i = 0; i < idle.size(); ++i) {
+                const size_t position = idle[i]->position();
+                if (best == idle.size() || (position <= index && (idle[best]->position() > index || position > idle[best]->position()))) {
+                    best = i;
+                }
+            }
+            const size_t others = busy++;
+            if (best < idle.size()) {
+                std::unique_ptr<VideoDecoder> decoder = std::move(idle[best]);
+                idle.erase(idle.begin() + best);
+                return decoder;
+            }
+            lock.unlock();
+
+            try {
+                return std::make_unique<VideoDecoder>(source, stream, others > 0 ? 1 : 0);
+            } catch (...) {
+                discard();
+                throw;
+            }
+        }
+
+        void release(std::unique_ptr<VideoDecoder> decoder) {
+            std::lock_guard<std::mutex> lock(mutex);
+            --busy;
+            idle.push_back(std::move(decoder));
+        }
+
+        // Drops a borrowed decoder whose state is unknown after a failed read
+        void discard() {
+            std::lock_guard<std::mutex> lock(mutex);
+            --busy;
+        }
+
+        void clear() {
+            std::lock_guard<std::mutex> lock(mutex);
+            idle.clear();
+        }
+    };
+    mutable VideoDecoderPool video_decoders;
+    mutable DecoderHandle<AudioDecoder> audio_decoder;
+    mutable FrameCache frame_cache;
+
+    // Conversion contexts for YUV420 preloads. Callers borrow one per frame, so parallel
+    // readers and streams never share a context and none is built per frame
+    struct ScalerPool {
+        std::vector<SwsContext*> idle;
+        std::mutex mutex;
+
+        ScalerPool() = default;
+        ScalerPool(const ScalerPool&) {}
+        ScalerPool& operator=(const ScalerPool&) { return *this; }
+        ~ScalerPool() { clear(); }
+
+        SwsContext* acquire(int width, int height) {
+            SwsContext* ctx = nullptr;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!idle.empty()) {
+                    ctx = idle.back();
+                    idle.pop_back();
+                }
+            }
+            // Reused as is while the frame size matches, rebuilt otherwise
+            ctx = sws_getCachedContext(ctx, width, height, AV_PIX_FMT_YUV420P,
+                                       width, height, AV_PIX_FMT_RGB24,
+                                       SWS_BILINEAR, nullptr, nullptr, nullptr);
+            if (!ctx) {
+                throw std::runtime_error("Cannot create sws context");
+            }
+            return ctx;
+        }
+
+        void release(SwsContext* ctx) {
+            std::lock_guard<std::mutex> lock(mutex);
+            idle.push_back(ctx);
+        }
+
+        void clear() {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (SwsContext* ctx : idle) {
+                sws_freeContext(ctx);
+            }
+            idle.clear();
+        }
+    };
+    mutable ScalerPool preload_scalers;
+    DirtyFrameStore dirty_frames;
+    bool frames_pending = false;                    // modified since the last flush
+
+    bool preload_enabled = false;
+    VideoPreload preload;
+    AlignedBuffer preload_arena;
+    size_t preload_count = 0;
+    size_t preload_frame_stride = 0;
+    size_t preload_plane_offsets[3] = {0, 0, 0};
+    int preload_linesizes[3] = {0, 0, 0};
+
+    static size_t physical_memory() {
+#if defined(__unix__) || defined(__APPLE__)
+        return static_cast<size_t>(sysconf(_SC_PHYS_PAGES)) * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#else
+        return std::numeric_limits<size_t>::max();
+#endif
+    }
+
+    // Frames share one aligned arena with a fixed stride; every plane row is aligned as well
+    void preload_frames() {
+        if (preload.first_frame >= video_frame_count) {
+            throw std::out_of_range("Preload range starts past the last frame");
+        }
+        preload_count = preload.frame_count == 0 ? video_frame_count - preload.first_frame
+                                                 : std::min(preload.frame_count, video_frame_count - preload.first_frame);
+
+        size_t plane_sizes[3] = {0, 0, 0};
+        if (preload.storage == VideoStorage::RGB24) {
+            preload_linesizes[0] = static_cast<int>(alignedSize(width * 3));
+            plane_sizes[0] = alignedSize(preload_linesizes[0] * height);
+        } else {
+            preload_linesizes[0] = static_cast<int>(alignedSize(width));
+            preload_linesizes[1] = preload_linesizes[2] = static_cast<int>(alignedSize((width + 1) / 2));
+            plane_sizes[0] = alignedSize(preload_linesizes[0] * height);
+            plane_sizes[1] = plane_sizes[2] = alignedSize(preload_linesizes[1] * ((height + 1) / 2));
+        }
+        preload_plane_offsets[0] = 0;
+        preload_plane_offsets[1] = plane_sizes[0];
+        preload_plane_offsets[2] = plane_sizes[0] + plane_sizes[1];
+        preload_frame_stride = plane_sizes[0] + plane_sizes[1] + plane_sizes[2];
+
+        const size_t budget = preload.memory_budget > 0 ? preload.memory_budget : physical_memory() / 2;
+        if (preload_count > budget / preload_frame_stride) {
+            throw std::runtime_error("Preloaded video needs " + std::to_string(preload_count * preload_frame_stride) +
+                                     " bytes, budget is " + std::to_string(budget));
+        }
+
+        const std::string cache_format = "video:" + std::to_string(static_cast<int>(preload.storage)) + ":" +
+                                         std::to_string(preload.first_frame) + ":" + std::to_string(preload_count);
+        std::vector<uint64_t> cached;
+        if (MediaCache::load(filename, cache_format, preload_arena, cached) &&
+            cached == std::vector<uint64_t>{width, height, preload_frame_stride} &&
+            preload_arena.size() == preload_count * preload_frame_stride) {
+            return;
+        }
+        preload_arena.resize(preload_count * preload_frame_stride);
+
+        // GOPs decode independently: each worker owns a single-threaded decoder and takes
+        // whole GOPs, frames land in their arena slots so no reordering is needed
+        const size_t first = preload.first_frame;
+        const size_t last = first + preload_count;
+        std::vector<size_t> segments = {first};
+        for (size_t keyframe : video_keyframes) {
+            if (keyframe > first && keyframe < last) {
+                segments.push_back(keyframe);
+            }
+        }
+        segments.push_back(last);
+
+        const AVPixelFormat format = preload.storage == VideoStorage::RGB24 ? AV_PIX_FMT_RGB24 : AV_PIX_FMT_YUV420P;
+        const int workers = static_cast<int>(std::min<size_t>(segments.size() - 1, preload.decode_threads > 0 ? preload.decode_threads : omp_get_max_threads()));
+        std::exception_ptr error;
+        std::atomic<bool> failed(false);
+
+        #pragma omp parallel num_threads(workers)
+        {
+            std::unique_ptr<VideoDecoder> decoder;
+            #pragma omp for schedule(dynamic, 1)
+            for (size_t segment = 0; segment < segments.size() - 1; ++segment) {
+                if (failed) continue;
+                try {
+                    if (!decoder) {
+                        decoder = std::make_unique<VideoDecoder>(filename, video_stream_index, workers > 1 ? 1 : 0);
+                    }
+                    for (size_t index = segments[segment]; index < segments[segment + 1]; ++index) {
+                        uint8_t* frame = preload_arena.data() + (index - first) * preload_frame_stride;
+                        uint8_t* dest[4] = {nullptr, nullptr, nullptr, nullptr};
+                        int dest_linesize[4] = {preload_linesizes[0], preload_linesizes[1], preload_linesizes[2], 0};
+                        for (int p = 0; p < 3; ++p) {
+                            if (plane_sizes[p] > 0) {
+                                dest[p] = frame + preload_plane_offsets[p];
+                            }
+                        }
+                        decoder->read(index, video_timestamps, video_keyframes, width, height, format, dest, dest_linesize);
+                    }
+                } catch (...) {
+                    if (!failed.exchange(true)) error = std::current_exception();
+                }
+            }
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        MediaCache::store(filename, cache_format, preload_arena.data(), preload_arena.size(), {width, height, preload_frame_stride});
+    }
+
+    const uint8_t* preloaded_frame_data(size_t index) const {
+        return preload_arena.data() + (index - preload.first_frame) * preload_frame_stride;
+    }
+
+    // Converts a preloaded YUV420 frame into RGB24 rows of the given stride
+    void convert_preloaded_frame(size_t index, uint8_t* rgb, size_t stride) const {
+        const uint8_t* frame = preloaded_frame_data(index);
+        SwsContext* sws_ctx = preload_scalers.acquire(width, height);
+        const uint8_t* src[4] = {frame + preload_plane_offsets[0], frame + preload_plane_offsets[1], frame + preload_plane_offsets[2], nullptr};
+        uint8_t* dest[4] = {rgb, nullptr, nullptr, nullptr};
+        int dest_linesize[4] = {static_cast<int>(stride), 0, 0, 0};
+        sws_scale(sws_ctx, src, preload_linesizes, 0, height, dest, dest_linesize);
+        preload_scalers.release(sws_ctx);
+    }
+
+    VideoFrameBuffer preloaded_video_frame(size_t index) const {
+        if (preload.storage == VideoStorage::RGB24) {
+            return VideoFrameBuffer(const_cast<DataVideo*>(this), index, width, height, preloaded_frame_data(index), preload_linesizes[0]);
+        }
+
+        VideoFrameBuffer result(const_cast<DataVideo*>(this), index, width, height);
+        convert_preloaded_frame(index, result.fill_row(0), result.stride());
+        return result;
+    }
 
     void init_ffmpeg() const {
         av_log_set_level(AV_LOG_ERROR);
@@ -170,6 +1102,8 @@ private:
             avformat_close_input(&fmt_ctx);
             throw std::runtime_error("No video or audio streams found in: " + filename);
         }
+        video_stream_index = video_info.stream_index;
+        audio_stream_index = audio_info.stream_index;
 
         if(video_info.stream_index != -1) {
             width = video_info.codecpar->width;
@@ -209,19 +1143,41 @@ private:
             throw std::runtime_error("Failed to find stream info for indexing");
         }
 
+        std::vector<int64_t> keyframe_timestamps;
         while(av_read_frame(fmt_ctx, pkt) >= 0) {
-            if(pkt->stream_index == 0) {
+            if(pkt->stream_index == video_stream_index) {
+                const int64_t timestamp = pkt->pts != AV_NOPTS_VALUE ? pkt->pts : pkt->dts;
                 video_positions.push_back(pkt->pos);
+                video_timestamps.push_back(timestamp);
+                if(pkt->flags & AV_PKT_FLAG_KEY) {
+                    keyframe_timestamps.push_back(timestamp);
+                }
             }
-            else if(pkt->stream_index == 1) {
+            else if(pkt->stream_index == audio_stream_index) {
+                const AVStream* stream = fmt_ctx->streams[audio_stream_index];
                 audio_positions.push_back(pkt->pos);
-                audio_sample_counts.push_back(
-                    pkt->duration > 0 ? pkt->duration : pkt->size / (2 * channels)
-                );
+                audio_timestamps.push_back(pkt->pts != AV_NOPTS_VALUE ? pkt->pts : pkt->dts);
+                if(pkt->duration > 0) {
+                    audio_sample_counts.push_back(av_rescale_q(pkt->duration, stream->time_base, AVRational{1, sample_rate}));
+                } else if(stream->codecpar->frame_size > 0) {
+                    audio_sample_counts.push_back(stream->codecpar->frame_size);
+                } else {
+                    audio_sample_counts.push_back(pkt->size / (2 * channels));
+                }
             }
             av_packet_unref(pkt);
         }
 
+        // Packets arrive in decode order, frames are addressed in presentation order
+        std::sort(video_timestamps.begin(), video_timestamps.end());
+        for(int64_t timestamp : keyframe_timestamps) {
+            video_keyframes.push_back(std::lower_bound(video_timestamps.begin(), video_timestamps.end(), timestamp) - video_timestamps.begin());
+        }
+        std::sort(video_keyframes.begin(), video_keyframes.end());
+        if(video_keyframes.empty() || video_keyframes.front() != 0) {
+            video_keyframes.insert(video_keyframes.begin(), 0);
+        }
+
         video_frame_count = video_positions.size();
         audio_frame_count = audio_positions.size();
 
@@ -229,251 +1185,245 @@ private:
         avformat_close_input(&fmt_ctx);
     }
 
-    VideoFrameBuffer load_video_frame_impl(size_t index, const std::string& source_file) const {
-        if (index >= video_frame_count) {
-            throw std::out_of_range("Invalid video frame index");
-        }
-    
-        AVFormatContext* fmt_ctx = nullptr;
-        AVCodecContext* codec_ctx = nullptr;
-        SwsContext* sws_ctx = nullptr;
-        AVPacket* pkt = av_packet_alloc();
-        AVFrame* frame = av_frame_alloc();
-        VideoFrameBuffer result(const_cast<DataVideo*>(this), index, width, height);
-        std::vector<uint8_t> rgb_buffer(width * height * 3);
-    
-        try {
-            // 1. Открываем файл
-            if (avformat_open_input(&fmt_ctx, source_file.c_str(), nullptr, nullptr) != 0) {
-                throw std::runtime_error("Cannot open input file");
-            }
-    
-            // 2. Получаем информацию о потоках
-            if (avformat_find_stream_info(fmt_ctx, nullptr) < 0) {
-                throw std::runtime_error("Cannot find stream information");
-            }
-    
-            // 3. Находим видео поток
-            int video_stream_idx = -1;
-            for (unsigned i = 0; i < fmt_ctx->nb_streams; i++) {
-                if (fmt_ctx->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
-                    video_stream_idx = i;
-                    break;
-                }
-            }
-    
-            if (video_stream_idx == -1) {
-                throw std::runtime_error("No video stream found");
-            }
-    
-            AVStream* video_stream = fmt_ctx->streams[video_stream_idx];
-            const AVCodec* codec = avcodec_find_decoder(video_stream->codecpar->codec_id);
-            if (!codec) {
-                throw std::runtime_error("Unsupported codec");
-            }
-    
-            // 4. Настраиваем контекст кодера
-            codec_ctx = avcodec_alloc_context3(codec);
-            if (!codec_ctx) {
-                throw std::runtime_error("Cannot allocate codec context");
-            }
-    
-            if (avcodec_parameters_to_context(codec_ctx, video_stream->codecpar) < 0) {
-                throw std::runtime_error("Cannot copy codec parameters");
-            }
-    
-            if (avcodec_open2(codec_ctx, codec, nullptr) < 0) {
-                throw std::runtime_error("Cannot open codec");
-            }
-    
-            // 5. Новый подход: последовательное чтение с начала
-            av_seek_frame(fmt_ctx, video_stream_idx, 0, AVSEEK_FLAG_BACKWARD);
-            avcodec_flush_buffers(codec_ctx);
-    
-            bool frame_decoded = false;
-            int current_frame = 0;
-            const int target_frame = static_cast<int>(index);
-            const int max_attempts = target_frame + 100; // Запас на случай проблем
-    
-            while (!frame_decoded && current_frame < max_attempts && av_read_frame(fmt_ctx, pkt) >= 0) {
-                if (pkt->stream_index == video_stream_idx) {
-                    if (avcodec_send_packet(codec_ctx, pkt) == 0) {
-                        while (!frame_decoded) {
-                            int ret = avcodec_receive_frame(codec_ctx, frame);
-                            if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
-                                break;
-                            } else if (ret < 0) {
-                                throw std::runtime_error("Error during decoding");
-                            }
-    
-                            if (current_frame == target_frame) {
-                                // Конвертируем в RGB
-                                sws_ctx = sws_getContext(
-                                    frame->width, frame->height, codec_ctx->pix_fmt,
-                                    width, height, AV_PIX_FMT_RGB24,
-                                    SWS_BILINEAR, nullptr, nullptr, nullptr);
-                                
-                                if (!sws_ctx) {
-                                    throw std::runtime_error("Cannot create sws context");
-                                }
-    
-                                uint8_t* dest[1] = {rgb_buffer.data()};
-                                int dest_linesize[1] = {static_cast<int>(width * 3)};
-                                sws_scale(sws_ctx, frame->data, frame->linesize, 0, 
-                                         frame->height, dest, dest_linesize);
-    
-                                // Копируем в буфер результата
-                                for (size_t y = 0; y < height; ++y) {
-                                    for (size_t x = 0; x < width; ++x) {
-                                        size_t idx = (y * width + x) * 3;
-                                        result.at(y, x, 0) = rgb_buffer[idx];
-                                        result.at(y, x, 1) = rgb_buffer[idx+1];
-                                        result.at(y, x, 2) = rgb_buffer[idx+2];
-                                    }
-                                }
-    
-                                frame_decoded = true;
-                            }
-                            av_frame_unref(frame);
-                            current_frame++;
-                        }
-                    }
-                }
-                av_packet_unref(pkt);
-            }
-    
-            if (!frame_decoded) {
-                throw std::runtime_error("Cannot decode frame " + std::to_string(index) + 
-                                       " (reached frame " + std::to_string(current_frame) + ")");
-            }
+    // Sidecar index next to the source: header, then metadata and index vectors.
+    // It is valid only while size, modification time and a hash of the first and
+    // last megabyte of the source still match.
+    static constexpr uint64_t index_magic = 0x3258444956545050ULL;  // "PPTVIDX2"
+
+    std::string index_filename() const {
+        return filename + ".frameindex";
+    }
+
+    std::vector<uint64_t> source_fingerprint() const {
+        const uint64_t size = std::filesystem::file_size(filename);
+        const uint64_t mtime = static_cast<uint64_t>(std::filesystem::last_write_time(filename).time_since_epoch().count());
+
+        const size_t block = 1 << 20;
+        std::vector<char> data(static_cast<size_t>(std::min<uint64_t>(size, 2 * block)));
+        std::ifstream file(filename, std::ios::binary);
+        if (size <= 2 * block) {
+            file.read(data.data(), data.size());
+        } else {
+            file.read(data.data(), block);
+            file.seekg(size - block);
+            file.read(data.data() + block, block);
         }
-        catch (...) {
-            if (sws_ctx) sws_freeContext(sws_ctx);
-            if (frame) av_frame_free(&frame);
-            if (pkt) av_packet_free(&pkt);
-            if (codec_ctx) avcodec_free_context(&codec_ctx);
-            if (fmt_ctx) avformat_close_input(&fmt_ctx);
-            throw;
+
+        uint64_t hash = 0xCBF29CE484222325ULL;
+        for (char c : data) {
+            hash = (hash ^ static_cast<uint8_t>(c)) * 0x100000001B3ULL;
         }
-    
-        if (sws_ctx) sws_freeContext(sws_ctx);
-        if (frame) av_frame_free(&frame);
-        if (pkt) av_packet_free(&pkt);
-        if (codec_ctx) avcodec_free_context(&codec_ctx);
-        if (fmt_ctx) avformat_close_input(&fmt_ctx);
-    
-        return result;
+        return {index_magic, size, mtime, hash};
     }
 
-    AudioFrameBuffer load_audio_frame_impl(size_t index, const std::string& source_file) const {
-        if(index >= audio_frame_count) {
-            throw std::out_of_range("Invalid audio frame index");
-        }
+    template <typename T>
+    static void write_index_vector(std::ofstream& file, const std::vector<T>& values) {
+        const uint64_t count = values.size();
+        file.write(reinterpret_cast<const char*>(&count), sizeof(count));
+        file.write(reinterpret_cast<const char*>(values.data()), count * sizeof(T));
+    }
 
-        AVFormatContext* fmt_ctx = nullptr;
-        AVCodecContext* codec_ctx = nullptr;
-        SwrContext* swr_ctx = nullptr;
-        AVPacket* pkt = av_packet_alloc();
-        AVFrame* frame = av_frame_alloc();
-        AVChannelLayout in_layout, out_layout;
-        AudioFrameBuffer result(const_cast<DataVideo*>(this), index, audio_sample_counts[index], channels);
+    template <typename T>
+    static void read_index_vector(std::ifstream& file, std::vector<T>& values) {
+        uint64_t count = 0;
+        file.read(reinterpret_cast<char*>(&count), sizeof(count));
+        if (!file || count > (uint64_t(1) << 40) / sizeof(T)) {
+            throw std::runtime_error("Corrupted frame index");
+        }
+        values.resize(count);
+        file.read(reinterpret_cast<char*>(values.data()), count * sizeof(T));
+    }
 
+    bool load_index() {
         try {
-            if(avformat_open_input(&fmt_ctx, source_file.c_str(), nullptr, nullptr) != 0) {
-                throw std::runtime_error("Failed to open audio file for frame loading");
+            std::ifstream file(index_filename(), std::ios::binary);
+            if (!file) {
+                return false;
             }
-
-            const AVCodec* codec = avcodec_find_decoder(AV_CODEC_ID_AAC);
-            if(!codec) {
-                throw std::runtime_error("Unsupported audio codec");
+            std::vector<uint64_t> header(4);
+            file.read(reinterpret_cast<char*>(header.data()), header.size() * sizeof(uint64_t));
+            if (!file || header != source_fingerprint()) {
+                return false;
             }
 
-            codec_ctx = avcodec_alloc_context3(codec);
-            if(!codec_ctx) {
-                throw std::runtime_error("Failed to allocate audio codec context");
+            int64_t fields[6];
+            file.read(reinterpret_cast<char*>(fields), sizeof(fields));
+            read_index_vector(file, video_positions);
+            read_index_vector(file, video_timestamps);
+            read_index_vector(file, video_keyframes);
+            read_index_vector(file, audio_positions);
+            read_index_vector(file, audio_timestamps);
+            read_index_vector(file, audio_sample_counts);
+            if (!file) {
+                throw std::runtime_error("Corrupted frame index");
             }
 
-            if(avcodec_parameters_to_context(codec_ctx, fmt_ctx->streams[1]->codecpar) < 0) {
-                throw std::runtime_error("Failed to copy audio codec parameters");
-            }
+            width = fields[0];
+            height = fields[1];
+            sample_rate = static_cast<int>(fields[2]);
+            channels = static_cast<int>(fields[3]);
+            video_stream_index = static_cast<int>(fields[4]);
+            audio_stream_index = static_cast<int>(fields[5]);
+            video_frame_count = video_positions.size();
+            audio_frame_count = audio_positions.size();
+            return true;
+        } catch (const std::exception&) {
+            clear();
+            return false;
+        }
+    }
 
-            if(avcodec_open2(codec_ctx, codec, nullptr) < 0) {
-                throw std::runtime_error("Failed to open audio codec");
+    // Best effort: a read-only source directory only costs the next start-up
+    void save_index() const {
+        const std::string temp = index_filename() + ".tmp";
+        try {
+            {
+                std::ofstream file(temp, std::ios::binary);
+                if (!file) {
+                    return;
+                }
+                const std::vector<uint64_t> header = source_fingerprint();
+                file.write(reinterpret_cast<const char*>(header.data()), header.size() * sizeof(uint64_t));
+
+                const int64_t fields[6] = {static_cast<int64_t>(width), static_cast<int64_t>(height), sample_rate, channels,
+                                           video_stream_index, audio_stream_index};
+                file.write(reinterpret_cast<const char*>(fields), sizeof(fields));
+                write_index_vector(file, video_positions);
+                write_index_vector(file, video_timestamps);
+                write_index_vector(file, video_keyframes);
+                write_index_vector(file, audio_positions);
+                write_index_vector(file, audio_timestamps);
+                write_index_vector(file, audio_sample_counts);
+                if (!file) {
+                    throw std::runtime_error("Failed to write frame index");
+                }
             }
+            std::filesystem::rename(temp, index_filename());
+        } catch (const std::exception&) {
+            std::error_code ec;
+            std::filesystem::remove(temp, ec);
+        }
+    }
 
-            av_channel_layout_copy(&in_layout, &codec_ctx->ch_layout);
-            av_channel_layout_default(&out_layout, channels);
+    VideoFrameBuffer load_video_frame_impl(size_t index, const std::string& source_file) const {
+        if (index >= video_frame_count) {
+            throw std::out_of_range("Invalid video frame index");
+        }
 
-            if(swr_alloc_set_opts2(&swr_ctx,
-                                 &out_layout, AV_SAMPLE_FMT_FLT, sample_rate,
-                                 &in_layout, codec_ctx->sample_fmt, sample_rate,
-                                 0, nullptr) < 0 || !swr_ctx) {
-                throw std::runtime_error("Failed to create swr context");
+        if (dirty_frames.size() > 0) {
+            VideoFrameBuffer result(const_cast<DataVideo*>(this), index, width, height);
+            if (dirty_frames.get(index, result.fill_row(0), result.stride(), width * 3, height)) {
+                return result;
             }
+        }
 
-            if(swr_init(swr_ctx) < 0) {
-                throw std::runtime_error("Failed to initialize swr context");
-            }
+        if (!preload_arena.empty()) {
+            return preloaded_video_frame(index);
+        }
 
-            if(av_seek_frame(fmt_ctx, 1, audio_positions[index], AVSEEK_FLAG_BYTE) < 0) {
-                throw std::runtime_error("Failed to seek to audio frame");
-            }
+        FrameCache::Frame rgb = frame_cache.enabled() ? frame_cache.find(index) : nullptr;
+        if (!rgb) {
+            rgb = decode_video_frame(index, source_file);
+        }
+        VideoFrameBuffer result(const_cast<DataVideo*>(this), index, width, height);
+        for (size_t y = 0; y < height; ++y) {
+            std::memcpy(result.fill_row(y), rgb->data() + y * width * 3, width * 3);
+        }
+        return result;
+    }
 
-            bool frame_decoded = false;
-            while(!frame_decoded && av_read_frame(fmt_ctx, pkt) >= 0) {
-                if(pkt->stream_index == 1) {
-                    if(avcodec_send_packet(codec_ctx, pkt) == 0) {
-                        while(avcodec_receive_frame(codec_ctx, frame) == 0) {
-                            uint8_t* out_data[1] = {reinterpret_cast<uint8_t*>(&result.at(0, 0))};
-                            if(swr_convert(swr_ctx, out_data, result.at(0, 0),
-                                          (const uint8_t**)frame->data, frame->nb_samples) < 0) {
-                                throw std::runtime_error("Failed to convert audio samples");
-                            }
+    FrameCache::Frame decode_video_frame(size_t index, const std::string& source_file) const {
+        std::unique_ptr<VideoDecoder> decoder = video_decoders.acquire(source_file, video_stream_index, index);
 
-                            frame_decoded = true;
-                            break;
-                        }
-                    }
-                }
-                av_packet_unref(pkt);
-            }
+        FrameCache::Frame frame;
+        try {
+            const uint8_t* rgb = decoder->read(index, video_timestamps, video_keyframes, width, height);
+            frame = std::make_shared<const std::vector<uint8_t>>(rgb, rgb + width * height * 3);
+        }
+        catch (...) {
+            video_decoders.discard();
+            throw;
+        }
+        video_decoders.release(std::move(decoder));
+
+        if (frame_cache.enabled()) {
+            frame_cache.insert(index, frame);
+        }
+        return frame;
+    }
+
+    // Produces one stream frame into slot. Returns where the frame lives, which is the
+    // preload arena when it needs no conversion; stride is updated to match.
+    // Streams decode sequentially with a private decoder and bypass the frame cache.
+    const uint8_t* stream_frame(size_t index, std::unique_ptr<VideoDecoder>& decoder, uint8_t* slot, size_t& stride) const {
+        if (dirty_frames.size() > 0 && dirty_frames.get(index, slot, stride, width * 3, height)) {
+            return slot;
+        }
 
-            if(!frame_decoded) {
-                throw std::runtime_error("Failed to decode audio frame");
+        if (!preload_arena.empty()) {
+            if (preload.storage == VideoStorage::RGB24) {
+                stride = preload_linesizes[0];
+                return preloaded_frame_data(index);
             }
+            convert_preloaded_frame(index, slot, stride);
+            return slot;
         }
-        catch(...) {
-            if(swr_ctx) swr_free(&swr_ctx);
-            av_channel_layout_uninit(&in_layout);
-            av_channel_layout_uninit(&out_layout);
-            if(frame) av_frame_free(&frame);
-            if(pkt) av_packet_free(&pkt);
-            if(codec_ctx) avcodec_free_context(&codec_ctx);
-            if(fmt_ctx) avformat_close_input(&fmt_ctx);
-            throw;
+
+        if (!decoder) {
+            decoder = std::make_unique<VideoDecoder>(filename, video_stream_index);
         }
+        uint8_t* dest[4] = {slot, nullptr, nullptr, nullptr};
+        int dest_linesize[4] = {static_cast<int>(stride), 0, 0, 0};
+        decoder->read(index, video_timestamps, video_keyframes, width, height, AV_PIX_FMT_RGB24, dest, dest_linesize);
+        return slot;
+    }
 
-        if(swr_ctx) swr_free(&swr_ctx);
-        av_channel_layout_uninit(&in_layout);
-        av_channel_layout_uninit(&out_layout);
-        if(frame) av_frame_free(&frame);
-        if(pkt) av_packet_free(&pkt);
-        if(codec_ctx) avcodec_free_context(&codec_ctx);
-        if(fmt_ctx) avformat_close_input(&fmt_ctx);
+    AudioFrameBuffer load_audio_frame_impl(size_t index, const std::string& source_file) const {
+        if(index >= audio_frame_count) {
+            throw std::out_of_range("Invalid audio frame index");
+        }
 
+        AudioFrameBuffer result(const_cast<DataVideo*>(this), index, audio_sample_counts[index], channels);
+        decode_audio_samples(audio_sample_offsets[index], audio_sample_counts[index], result.audio_data.data(), source_file);
         return result;
     }
 
+    void decode_audio_samples(size_t start, size_t count, float* out, const std::string& source_file) const {
+        std::lock_guard<std::mutex> lock(audio_decoder.mutex);
+        if (!audio_decoder.decoder || audio_decoder.decoder->source() != source_file) {
+            audio_decoder.decoder.reset();
+            audio_decoder.decoder = std::make_unique<AudioDecoder>(source_file, audio_stream_index, sample_rate, channels);
+        }
+
+        try {
+            audio_decoder.decoder->read(start, count, audio_timestamps, audio_sample_offsets, out);
+        }
+        catch (...) {
+            audio_decoder.decoder.reset();
+            throw;
+        }
+    }
+
 public:
     
 
-    DataVideo(const std::string& filename) : 
+    // frame_cache_bytes bounds the LRU cache of decoded frames, 0 disables it.
+    // dirty_frame_bytes bounds modified frames held in memory until the next flush.
+    DataVideo(const std::string& filename, size_t frame_cache_bytes = size_t(256) << 20, size_t dirty_frame_bytes = size_t(512) << 20) : 
         filename(filename),
         width(0), height(0),
         sample_rate(0), channels(0),
-        video_frame_count(0), audio_frame_count(0) {
+        video_frame_count(0), audio_frame_count(0),
+        frame_cache(frame_cache_bytes),
+        dirty_frames(dirty_frame_bytes) {
         init_ffmpeg();
     }
+
+    DataVideo(const std::string& filename, const VideoPreload& preload, size_t dirty_frame_bytes = size_t(512) << 20) :
+        DataVideo(filename, 0, dirty_frame_bytes) {
+        preload_enabled = true;
+        this->preload = preload;
+    }
     
     ~DataVideo() override {
         clear();
@@ -485,18 +1435,72 @@ public:
 
     void read() override {
         if(!filename.empty()) {
-            load_metadata();
-            build_frame_index();
+            if(!load_index()) {
+                load_metadata();
+                build_frame_index();
+                save_index();
+            }
+            audio_sample_offsets.assign(audio_sample_counts.size() + 1, 0);
+            for(size_t i = 0; i < audio_sample_counts.size(); ++i) {
+                audio_sample_offsets[i + 1] = audio_sample_offsets[i] + audio_sample_counts[i];
+            }
+            if(preload_enabled) {
+                preload_frames();
+            }
         }
     }
 
     VideoFrameBuffer read_video_frame(size_t index) const {
+        if(preload_enabled) {
+            if(index >= preload_count) {
+                throw std::out_of_range("Invalid video frame index");
+            }
+            return load_video_frame_impl(preload.first_frame + index, filename);
+        }
         if(index >= video_frame_count) {
             throw std::out_of_range("Invalid video frame index");
         }
         return load_video_frame_impl(index, filename);
     }
 
+    // Frames in order with decoding overlapped with the consumer, indices as in read_video_frame.
+    // count 0 streams to the last frame; depth frames are decoded ahead.
+    VideoFrameStream stream(size_t first = 0, size_t count = 0, size_t depth = 4) const {
+        const size_t frames = preload_enabled ? preload_count : video_frame_count;
+        if(first >= frames) {
+            throw std::out_of_range("Invalid video frame index");
+        }
+        count = count == 0 ? frames - first : std::min(count, frames - first);
+
+        const size_t base = (preload_enabled ? preload.first_frame : 0) + first;
+        const size_t stride = alignedSize(width * 3);
+        return VideoFrameStream(count, depth, stride * height,
+            [this, base, first, stride, decoder = std::unique_ptr<VideoDecoder>()](size_t i, uint8_t* slot, VideoFrameView& frame) mutable {
+                frame.index = first + i;
+                frame.width = width;
+                frame.height = height;
+                frame.stride = stride;
+                frame.data = stream_frame(base + i, decoder, slot, frame.stride);
+                return true;
+            });
+    }
+
+    size_t audio_sample_count() const {
+        return audio_sample_offsets.empty() ? 0 : audio_sample_offsets.back();
+    }
+
+    // Interleaved float samples [start, start + count) of the audio track
+    std::vector<float> read_samples(size_t start, size_t count) const {
+        if(audio_stream_index < 0 || start > audio_sample_count() || count > audio_sample_count() - start) {
+            throw std::out_of_range("Invalid audio sample range");
+        }
+        std::vector<float> samples(count * channels);
+        if(count > 0) {
+            decode_audio_samples(start, count, samples.data(), filename);
+        }
+        return samples;
+    }
+
     AudioFrameBuffer read_audio_frame(size_t index) const {
         if(index >= audio_frame_count) {
             throw std::out_of_range("Invalid audio frame index");
@@ -506,15 +1510,30 @@ public:
     }
 
     void clear() override {
+        video_decoders.clear();
+        {
+            std::lock_guard<std::mutex> lock(audio_decoder.mutex);
+            audio_decoder.decoder.reset();
+        }
+        frame_cache.clear();
+        preload_scalers.clear();
+        preload_arena.reset();
+        preload_count = 0;
         video_positions.clear();
+        video_timestamps.clear();
+        video_keyframes.clear();
         audio_positions.clear();
+        audio_timestamps.clear();
         audio_sample_counts.clear();
+        audio_sample_offsets.clear();
         width = height = 0;
         sample_rate = channels = 0;
         video_frame_count = audio_frame_count = 0;
     }
 
     void clear_copy() override {
+            dirty_frames.clear();
+            frames_pending = false;
             try {
                 if(std::filesystem::exists(copy_filename)) {
                     std::filesystem::remove(copy_filename);
@@ -528,13 +1547,13 @@ public:
         clear_copy();
         create_temp_copy();
         
-        auto video_loader = [this](size_t idx) { return read_video_frame(idx); };
-        auto audio_loader = [this](size_t idx) { return read_audio_frame(idx); };
+        VideoFrame video_loader(this);
+        AudioFrame audio_loader(this);
         
         _copy = std::make_tuple(
             video_loader,
             audio_loader,
-            video_frame_count,
+            preload_enabled ? preload_count : video_frame_count,
             width,
             height,
             audio_frame_count,
@@ -550,11 +1569,14 @@ public:
             throw std::runtime_error("No video frames available to save");
         }
 
+        const_cast<DataVideo*>(this)->flush();
+
         std::string output_name = "proc" + proc_data_str(args_id, thread_num) + "_" + 
                                 std::filesystem::path(filename).filename().string();
         std::filesystem::path output_path = std::filesystem::path(dir) / output_name;
         
-        std::filesystem::copy_file(filename, output_path, 
+        const std::string& source = !copy_filename.empty() && std::filesystem::exists(copy_filename) ? copy_filename : filename;
+        std::filesystem::copy_file(source, output_path, 
                                  std::filesystem::copy_options::overwrite_existing);
         
         return output_name;
@@ -576,235 +1598,232 @@ public:
         return std::string("video");
     }
 
-    void commit_frame(size_t index, const std::vector<std::vector<uint8_t>>& frame_data) {
-        // === Проверка ===
+    std::map<std::string, size_t> statistics() const override {
+        return frame_cache.enabled() ? frame_cache.statistics() : std::map<std::string, size_t>();
+    }
+
+    void reset_statistics() override {
+        frame_cache.reset_statistics();
+    }
+
+    // Records a modified frame of RGB24 rows stride bytes apart; the copy is rewritten
+    // once by flush() or save_copy()
+    void commit_frame(size_t index, const uint8_t* frame_data, size_t stride) {
         if (index >= video_frame_count) {
             throw std::out_of_range("Frame index out of range");
         }
-        if (frame_data.empty() || frame_data.size() != height || frame_data[0].size() != width * 3) {
+        if (!frame_data || stride < width * 3) {
             throw std::invalid_argument("Invalid frame data dimensions");
         }
-    
-        // === Создание временного выходного файла ===
-        std::string temp_output = "temp_output.mp4";
+        dirty_frames.put(index, frame_data, stride, width * 3, height);
+        frames_pending = true;
+    }
+
+    // Applies every recorded frame to the copy in a single transcode pass; reads are still
+    // served from the recorded frames and the source, never from the re-encoded copy
+    void flush() {
+        if (!frames_pending) {
+            return;
+        }
+        const size_t pending = dirty_frames.size();
+        if (copy_filename.empty()) {
+            create_temp_copy();
+        }
+
+        std::filesystem::path copy_path(copy_filename);
+        std::string temp_output = (copy_path.parent_path() / ("flush_" + copy_path.filename().string())).string();
     
         AVFormatContext* input_fmt_ctx = nullptr;
         AVFormatContext* output_fmt_ctx = nullptr;
         AVCodecContext* dec_ctx = nullptr;
         AVCodecContext* enc_ctx = nullptr;
         AVPacket* packet = av_packet_alloc();
+        AVPacket* enc_pkt = av_packet_alloc();
         AVFrame* frame = av_frame_alloc();
+        AVFrame* yuv_frame = nullptr;
         SwsContext* sws_ctx = nullptr;
+        std::vector<uint8_t> rgb(width * height * 3);
     
-        int ret = 0;
-        int video_stream_index = -1;
-        bool frame_replaced = false;
+        int stream_index = -1;
+        size_t frames_replaced = 0;
+        size_t current_frame_index = 0;
+
+        auto free_all = [&]() {
+            if (input_fmt_ctx) avformat_close_input(&input_fmt_ctx);
+            if (output_fmt_ctx) {
+                if (!(output_fmt_ctx->oformat->flags & AVFMT_NOFILE)) {
+                    avio_closep(&output_fmt_ctx->pb);
+                }
+                avformat_free_context(output_fmt_ctx);
+                output_fmt_ctx = nullptr;
+            }
+            if (dec_ctx) avcodec_free_context(&dec_ctx);
+            if (enc_ctx) avcodec_free_context(&enc_ctx);
+            if (frame) av_frame_free(&frame);
+            if (yuv_frame) av_frame_free(&yuv_frame);
+            if (packet) av_packet_free(&packet);
+            if (enc_pkt) av_packet_free(&enc_pkt);
+            if (sws_ctx) sws_freeContext(sws_ctx);
+            sws_ctx = nullptr;
+        };
+
+        auto write_encoded = [&]() {
+            while (avcodec_receive_packet(enc_ctx, enc_pkt) >= 0) {
+                enc_pkt->stream_index = stream_index;
+                av_packet_rescale_ts(enc_pkt, enc_ctx->time_base,
+                                     output_fmt_ctx->streams[stream_index]->time_base);
+                av_interleaved_write_frame(output_fmt_ctx, enc_pkt);
+                av_packet_unref(enc_pkt);
+            }
+        };
+
+        auto encode_decoded = [&]() {
+            while (avcodec_receive_frame(dec_ctx, frame) >= 0) {
+                if (dirty_frames.get(current_frame_index, rgb.data(), width * 3, width * 3, height)) {
+                    // Конвертация RGB -> YUV
+                    const uint8_t* src[1] = {rgb.data()};
+                    int src_linesize[1] = {static_cast<int>(width * 3)};
+                    av_frame_make_writable(yuv_frame);
+                    sws_scale(sws_ctx, src, src_linesize, 0, height, yuv_frame->data, yuv_frame->linesize);
+                    yuv_frame->pts = frame->pts;
+                    avcodec_send_frame(enc_ctx, yuv_frame);
+                    frames_replaced++;
+                } else {
+                    // Просто перекодируем оригинальный кадр
+                    avcodec_send_frame(enc_ctx, frame);
+                }
+                write_encoded();
+                current_frame_index++;
+                av_frame_unref(frame);
+            }
+        };
     
         try {
-            // === Открываем входной файл ===
-            if ((ret = avformat_open_input(&input_fmt_ctx, copy_filename.c_str(), nullptr, nullptr)) < 0) {
+            if (avformat_open_input(&input_fmt_ctx, copy_filename.c_str(), nullptr, nullptr) < 0) {
                 throw std::runtime_error("Failed to open input file");
             }
-            if ((ret = avformat_find_stream_info(input_fmt_ctx, nullptr)) < 0) {
+            if (avformat_find_stream_info(input_fmt_ctx, nullptr) < 0) {
                 throw std::runtime_error("Failed to find stream info");
             }
     
-            // === Создаём выходной формат ===
             avformat_alloc_output_context2(&output_fmt_ctx, nullptr, nullptr, temp_output.c_str());
             if (!output_fmt_ctx) {
                 throw std::runtime_error("Failed to create output context");
             }
     
-            // === Копируем потоки ===
             for (unsigned i = 0; i < input_fmt_ctx->nb_streams; i++) {
                 AVStream* in_stream = input_fmt_ctx->streams[i];
                 AVStream* out_stream = avformat_new_stream(output_fmt_ctx, nullptr);
                 if (!out_stream) {
                     throw std::runtime_error("Failed to allocate output stream");
                 }
-    
                 if (avcodec_parameters_copy(out_stream->codecpar, in_stream->codecpar) < 0) {
                     throw std::runtime_error("Failed to copy codec parameters");
                 }
-    
                 out_stream->codecpar->codec_tag = 0;
                 out_stream->time_base = in_stream->time_base;
     
-                if (in_stream->codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
-                    video_stream_index = i;
+                if (in_stream->codecpar->codec_type == AVMEDIA_TYPE_VIDEO && stream_index == -1) {
+                    stream_index = i;
                 }
             }
-    
-            if (video_stream_index == -1) {
+            if (stream_index == -1) {
                 throw std::runtime_error("No video stream found");
             }
     
-            // === Открываем файл для записи ===
             if (!(output_fmt_ctx->oformat->flags & AVFMT_NOFILE)) {
-                if ((ret = avio_open(&output_fmt_ctx->pb, temp_output.c_str(), AVIO_FLAG_WRITE)) < 0) {
+                if (avio_open(&output_fmt_ctx->pb, temp_output.c_str(), AVIO_FLAG_WRITE) < 0) {
                     throw std::runtime_error("Failed to open output file");
                 }
             }
-    
-            // === Пишем заголовок ===
-            if ((ret = avformat_write_header(output_fmt_ctx, nullptr)) < 0) {
+            if (avformat_write_header(output_fmt_ctx, nullptr) < 0) {
                 throw std::runtime_error("Failed to write header");
             }
     
-            // === Инициализируем декодер ===
-            const AVCodec* decoder = avcodec_find_decoder(input_fmt_ctx->streams[video_stream_index]->codecpar->codec_id);
+            const AVCodec* decoder = avcodec_find_decoder(input_fmt_ctx->streams[stream_index]->codecpar->codec_id);
+            if (!decoder) {
+                throw std::runtime_error("Video decoder not found");
+            }
             dec_ctx = avcodec_alloc_context3(decoder);
-            avcodec_parameters_to_context(dec_ctx, input_fmt_ctx->streams[video_stream_index]->codecpar);
-            avcodec_open2(dec_ctx, decoder, nullptr);
+            if (!dec_ctx) {
+                throw std::runtime_error("Failed to allocate decoder context");
+            }
+            avcodec_parameters_to_context(dec_ctx, input_fmt_ctx->streams[stream_index]->codecpar);
+            dec_ctx->thread_count = 0;
+            dec_ctx->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+            if (avcodec_open2(dec_ctx, decoder, nullptr) < 0) {
+                throw std::runtime_error("Failed to open decoder");
+            }
     
-            // === Инициализируем энкодер ===
             const AVCodec* encoder = avcodec_find_encoder(dec_ctx->codec_id);
+            if (!encoder) {
+                throw std::runtime_error(std::string("No encoder available for ") + avcodec_get_name(dec_ctx->codec_id));
+            }
             enc_ctx = avcodec_alloc_context3(encoder);
-    
+            if (!enc_ctx) {
+                throw std::runtime_error("Failed to allocate encoder context");
+            }
             enc_ctx->height = dec_ctx->height;
             enc_ctx->width = dec_ctx->width;
             enc_ctx->sample_aspect_ratio = dec_ctx->sample_aspect_ratio;
             enc_ctx->pix_fmt = encoder->pix_fmts ? encoder->pix_fmts[0] : dec_ctx->pix_fmt;
-            enc_ctx->time_base = input_fmt_ctx->streams[video_stream_index]->time_base;
-    
+            enc_ctx->time_base = input_fmt_ctx->streams[stream_index]->time_base;
+            enc_ctx->thread_count = 0;
             if (output_fmt_ctx->oformat->flags & AVFMT_GLOBALHEADER)
                 enc_ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
-    
-            avcodec_open2(enc_ctx, encoder, nullptr);
-    
-            // === Начинаем обработку кадров ===
-            size_t current_frame_index = 0;
+            if (avcodec_open2(enc_ctx, encoder, nullptr) < 0) {
+                throw std::runtime_error("Failed to open encoder");
+            }
+
+            sws_ctx = sws_getContext(width, height, AV_PIX_FMT_RGB24,
+                                     width, height, enc_ctx->pix_fmt,
+                                     SWS_BICUBIC, nullptr, nullptr, nullptr);
+            yuv_frame = av_frame_alloc();
+            if (!sws_ctx || !yuv_frame) {
+                throw std::runtime_error("Failed to prepare frame conversion");
+            }
+            yuv_frame->format = enc_ctx->pix_fmt;
+            yuv_frame->width = width;
+            yuv_frame->height = height;
+            if (av_frame_get_buffer(yuv_frame, 32) < 0) {
+                throw std::runtime_error("Failed to allocate frame");
+            }
     
             while (av_read_frame(input_fmt_ctx, packet) >= 0) {
-                if (packet->stream_index == video_stream_index) {
+                if (packet->stream_index == stream_index) {
                     avcodec_send_packet(dec_ctx, packet);
-                    while (avcodec_receive_frame(dec_ctx, frame) >= 0) {
-                        if (current_frame_index == index) {
-                            // === Конвертируем RGB => YUV ===
-                            AVFrame* rgb_frame = av_frame_alloc();
-                            rgb_frame->format = AV_PIX_FMT_RGB24;
-                            rgb_frame->width = width;
-                            rgb_frame->height = height;
-                            av_image_alloc(rgb_frame->data, rgb_frame->linesize, width, height, AV_PIX_FMT_RGB24, 1);
-    
-                            // Копируем данные
-                            for (int y = 0; y < height; ++y) {
-                                memcpy(rgb_frame->data[0] + y * rgb_frame->linesize[0],
-                                       frame_data[y].data(), width * 3);
-                            }
-    
-                            // Конвертация RGB -> YUV
-                            sws_ctx = sws_getContext(width, height, AV_PIX_FMT_RGB24,
-                                                     width, height, enc_ctx->pix_fmt,
-                                                     SWS_BICUBIC, nullptr, nullptr, nullptr);
-    
-                            AVFrame* yuv_frame = av_frame_alloc();
-                            yuv_frame->format = enc_ctx->pix_fmt;
-                            yuv_frame->width = width;
-                            yuv_frame->height = height;
-                            av_frame_get_buffer(yuv_frame, 32);
-                            av_frame_make_writable(yuv_frame);
-    
-                            sws_scale(sws_ctx, rgb_frame->data, rgb_frame->linesize, 0, height,
-                                      yuv_frame->data, yuv_frame->linesize);
-                            yuv_frame->pts = frame->pts;
-    
-                            // Кодируем и записываем
-                            avcodec_send_frame(enc_ctx, yuv_frame);
-                            AVPacket enc_pkt;
-                            av_init_packet(&enc_pkt);
-                            enc_pkt.data = nullptr;
-                            enc_pkt.size = 0;
-    
-                            while (avcodec_receive_packet(enc_ctx, &enc_pkt) >= 0) {
-                                enc_pkt.stream_index = video_stream_index;
-                                av_packet_rescale_ts(&enc_pkt, enc_ctx->time_base,
-                                                     output_fmt_ctx->streams[video_stream_index]->time_base);
-                                av_interleaved_write_frame(output_fmt_ctx, &enc_pkt);
-                                av_packet_unref(&enc_pkt);
-                            }
-    
-                            av_frame_free(&rgb_frame);
-                            av_frame_free(&yuv_frame);
-                            frame_replaced = true;
-    
-                        } else {
-                            // Просто перекодируем оригинальный кадр
-                            avcodec_send_frame(enc_ctx, frame);
-                            AVPacket enc_pkt;
-                            av_init_packet(&enc_pkt);
-                            enc_pkt.data = nullptr;
-                            enc_pkt.size = 0;
-    
-                            while (avcodec_receive_packet(enc_ctx, &enc_pkt) >= 0) {
-                                enc_pkt.stream_index = video_stream_index;
-                                av_packet_rescale_ts(&enc_pkt, enc_ctx->time_base,
-                                                     output_fmt_ctx->streams[video_stream_index]->time_base);
-                                av_interleaved_write_frame(output_fmt_ctx, &enc_pkt);
-                                av_packet_unref(&enc_pkt);
-                            }
-                        }
-    
-                        current_frame_index++;
-                        av_frame_unref(frame);
-                    }
+                    encode_decoded();
                 } else {
                     // Копируем не-видео потоки без изменений
                     AVStream* in_stream = input_fmt_ctx->streams[packet->stream_index];
                     AVStream* out_stream = output_fmt_ctx->streams[packet->stream_index];
-    
                     av_packet_rescale_ts(packet, in_stream->time_base, out_stream->time_base);
                     packet->pos = -1;
                     av_interleaved_write_frame(output_fmt_ctx, packet);
                 }
-    
                 av_packet_unref(packet);
             }
+
+            // Дочитываем кадры из декодера и энкодера
+            avcodec_send_packet(dec_ctx, nullptr);
+            encode_decoded();
+            avcodec_send_frame(enc_ctx, nullptr);
+            write_encoded();
     
-            // Завершаем запись
             av_write_trailer(output_fmt_ctx);
+            free_all();
     
-            // === Закрытие ===
-            avcodec_free_context(&dec_ctx);
-            avcodec_free_context(&enc_ctx);
-            avformat_close_input(&input_fmt_ctx);
-    
-            if (!(output_fmt_ctx->oformat->flags & AVFMT_NOFILE)) {
-                avio_closep(&output_fmt_ctx->pb);
-            }
-    
-            avformat_free_context(output_fmt_ctx);
-            av_frame_free(&frame);
-            av_packet_free(&packet);
-            if (sws_ctx) sws_freeContext(sws_ctx);
-    
-            // === Проверка, был ли заменён кадр ===
-            if (!frame_replaced) {
-                throw std::runtime_error("Target frame not found or replaced");
+            if (frames_replaced != pending) {
+                throw std::runtime_error("Modified frames not found in video");
             }
     
-            // === Заменяем оригинальный файл новым ===
             std::filesystem::rename(temp_output, copy_filename);
+            frames_pending = false;
         }
         catch (...) {
-            // Очистка ресурсов при ошибке
-            if (input_fmt_ctx) avformat_close_input(&input_fmt_ctx);
-            if (output_fmt_ctx) {
-                if (!(output_fmt_ctx->oformat->flags & AVFMT_NOFILE)) {
-                    avio_closep(&output_fmt_ctx->pb);
-                }
-                avformat_free_context(output_fmt_ctx);
-            }
-            if (dec_ctx) avcodec_free_context(&dec_ctx);
-            if (enc_ctx) avcodec_free_context(&enc_ctx);
-            if (frame) av_frame_free(&frame);
-            if (packet) av_packet_free(&packet);
-            if (sws_ctx) sws_freeContext(sws_ctx);
-    
-            // Удаляем временный файл, если он остался
+            free_all();
             std::remove(temp_output.c_str());
-    
-            throw;  // Пробрасываем исключение дальше
+            throw;
         }
     }
     
@@ -978,15 +1997,39 @@ public:
 
 inline VideoFrameBuffer::VideoFrameBuffer(DataVideo* p, size_t idx, size_t w, size_t h) : 
     parent(p), frame_index(idx), modified(false), width(w), height(h),
-    frame_data(h, std::vector<uint8_t>(w * 3)) {}
+    frame_data(alignedSize(w * 3) * h), frame_stride(alignedSize(w * 3)) {}
+
+inline VideoFrameBuffer::VideoFrameBuffer(DataVideo* p, size_t idx, size_t w, size_t h, const uint8_t* data, size_t stride) : 
+    parent(p), frame_index(idx), modified(false), width(w), height(h),
+    frame_stride(stride), view(data) {}
 
 inline void VideoFrameBuffer::commit() {
     if (modified && parent) {
-        parent->commit_frame(frame_index, frame_data);
         modified = false;
+        parent->commit_frame(frame_index, frame_data.data(), frame_stride);
     }
 }
 
+inline VideoFrameBuffer VideoFrame::operator()(size_t index) const {
+    return video->read_video_frame(index);
+}
+
+inline VideoFrameStream VideoFrame::stream(size_t first, size_t count, size_t depth) const {
+    return video->stream(first, count, depth);
+}
+
+inline AudioFrameBuffer AudioFrame::operator()(size_t index) const {
+    return video->read_audio_frame(index);
+}
+
+inline std::vector<float> AudioFrame::read_samples(size_t start, size_t count) const {
+    return video->read_samples(start, count);
+}
+
+inline size_t AudioFrame::sample_count() const {
+    return video->audio_sample_count();
+}
+
 inline AudioFrameBuffer::AudioFrameBuffer(DataVideo* p, size_t idx, size_t samples, int channels) : 
     parent(p), frame_index(idx), modified(false), 
     sample_count(samples), channel_count(channels),
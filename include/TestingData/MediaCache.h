@@ -0,0 +1,294 @@
+#ifndef MEDIA_CACHE_H
+#define MEDIA_CACHE_H
+
+#include "Data.h"
+#include <string>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <fstream>
+#include <filesystem>
+#include <functional>
+#include <algorithm>
+#include <stdexcept>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/file.h>
+#endif
+
+// Decoded media kept on disk between runs, so repeated benchmarks map pixels or samples
+// instead of decoding them again. An entry is one file: a header padded to a page boundary,
+// then the raw payload. It is keyed by the source path and the decoded format, and is only
+// valid while the size and modification time of every file it was decoded from still match.
+// Processes sharing a directory hold a lock file: loads take it shared, while replacing and
+// evicting entries takes it exclusively. Entries already mapped survive their removal.
+class MediaCache {
+public:
+    // An empty directory disables the cache; beyond capacity bytes the least recently used
+    // entries are evicted
+    static void configure(const std::string& directory, size_t capacity = size_t(16) << 30) {
+        Settings& current = settings();
+        std::lock_guard<std::mutex> lock(current.mutex);
+        current.directory = directory;
+        current.capacity = capacity;
+    }
+
+    static void disable() {
+        configure("");
+    }
+
+    static bool enabled() {
+        return !directory().empty();
+    }
+
+    // On a hit payload maps the stored bytes copy-on-write and params receives the values
+    // stored with them
+    static bool load(const std::string& source, const std::string& format, AlignedBuffer& payload, std::vector<uint64_t>& params) {
+        return load(source, {source}, format, payload, params);
+    }
+
+    // Entry named by source but decoded from files, such as an image directory
+    static bool load(const std::string& source, const std::vector<std::string>& files, const std::string& format,
+                     AlignedBuffer& payload, std::vector<uint64_t>& params) {
+        const std::string dir = directory();
+        if (dir.empty()) {
+            return false;
+        }
+        try {
+            const Key key = makeKey(source, files, format);
+            const std::filesystem::path entry = entryPath(dir, key);
+            const DirectoryLock lock(dir, false);
+            std::ifstream file(entry, std::ios::binary);
+            if (!file) {
+                return false;
+            }
+
+            uint64_t header[headerFields];
+            file.read(reinterpret_cast<char*>(header), sizeof(header));
+            if (!file || header[0] != magic || header[1] != key.hash || header[2] != key.size || header[3] != key.mtime) {
+                return false;
+            }
+            const uint64_t bytes = header[4];
+            const uint64_t offset = header[5];
+            const uint64_t count = header[6];
+            const uint64_t nameLength = header[7];
+            if (offset % pageSize() != 0 || sizeof(header) + count * sizeof(uint64_t) + nameLength > offset ||
+                std::filesystem::file_size(entry) < offset + bytes) {
+                return false;
+            }
+
+            std::vector<uint64_t> values(count);
+            std::string name(nameLength, '\0');
+            file.read(reinterpret_cast<char*>(values.data()), count * sizeof(uint64_t));
+            file.read(name.data(), nameLength);
+            if (!file || name != key.name) {
+                return false;
+            }
+            file.close();
+
+            // map() throws when the entry cannot be mapped, which ends up as a miss below
+            payload = AlignedBuffer::map(entry.string(), offset, bytes);
+            params = std::move(values);
+            std::error_code ec;
+            std::filesystem::last_write_time(entry, std::filesystem::file_time_type::clock::now(), ec);
+            return true;
+        } catch (const std::exception&) {
+            return false;
+        }
+    }
+
+    // Best effort: a full or read-only cache directory only costs decoding next time
+    static void store(const std::string& source, const std::string& format, const void* payload, size_t bytes, const std::vector<uint64_t>& params) {
+        store(source, {source}, format, payload, bytes, params);
+    }
+
+    static void store(const std::string& source, const std::vector<std::string>& files, const std::string& format,
+                      const void* payload, size_t bytes, const std::vector<uint64_t>& params) {
+        std::string dir;
+        size_t capacity = 0;
+        {
+            Settings& current = settings();
+            std::lock_guard<std::mutex> lock(current.mutex);
+            dir = current.directory;
+            capacity = current.capacity;
+        }
+        if (dir.empty() || bytes > capacity) {
+            return;
+        }
+
+        std::filesystem::path temp;
+        try {
+            const Key key = makeKey(source, files, format);
+            const std::filesystem::path entry = entryPath(dir, key);
+            temp = entry;
+            temp += ".tmp" + std::to_string(processId()) + "_" + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+            std::filesystem::create_directories(dir);
+
+            const uint64_t used = headerFields * sizeof(uint64_t) + params.size() * sizeof(uint64_t) + key.name.size();
+            const uint64_t offset = (used + pageSize() - 1) / pageSize() * pageSize();
+            const uint64_t header[headerFields] = {magic, key.hash, key.size, key.mtime, bytes, offset, params.size(), key.name.size()};
+            {
+                std::ofstream file(temp, std::ios::binary);
+                if (!file) {
+                    return;
+                }
+                file.write(reinterpret_cast<const char*>(header), sizeof(header));
+                file.write(reinterpret_cast<const char*>(params.data()), params.size() * sizeof(uint64_t));
+                file.write(key.name.data(), key.name.size());
+                const std::vector<char> padding(offset - used, 0);
+                file.write(padding.data(), padding.size());
+                file.write(static_cast<const char*>(payload), bytes);
+                if (!file) {
+                    throw std::runtime_error("Failed to write media cache entry");
+                }
+            }
+            const DirectoryLock lock(dir, true);
+            std::filesystem::rename(temp, entry);
+            evict(dir, capacity);
+        } catch (const std::exception&) {
+            std::error_code ec;
+            std::filesystem::remove(temp, ec);
+        }
+    }
+
+private:
+    static constexpr uint64_t magic = 0x314344454D545050ULL;  // "PPTMEDC1"
+    static constexpr size_t headerFields = 8;
+
+    struct Settings {
+        std::mutex mutex;
+        std::string directory;
+        size_t capacity = size_t(16) << 30;
+    };
+
+    struct Key {
+        std::string name;
+        uint64_t hash = 0;
+        uint64_t size = 0;
+        uint64_t mtime = 0;
+    };
+
+    static Settings& settings() {
+        static Settings instance;
+        return instance;
+    }
+
+    static std::string directory() {
+        Settings& current = settings();
+        std::lock_guard<std::mutex> lock(current.mutex);
+        return current.directory;
+    }
+
+    // Thread ids repeat across processes, so temporary entries also carry the process
+    static uint64_t processId() {
+#if defined(__unix__) || defined(__APPLE__)
+        return static_cast<uint64_t>(::getpid());
+#else
+        static const uint64_t id = std::random_device()();
+        return id;
+#endif
+    }
+
+    static uint64_t pageSize() {
+#if defined(__unix__) || defined(__APPLE__)
+        return static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+#else
+        return 4096;
+#endif
+    }
+
+    // Advisory lock on the cache directory; without one, as on a read-only directory, the
+    // cache still works but processes may evict an entry between its check and its mapping
+    class DirectoryLock {
+    public:
+        DirectoryLock(const std::string& dir, bool exclusive) {
+#if defined(__unix__) || defined(__APPLE__)
+            _fd = ::open((std::filesystem::path(dir) / ".lock").c_str(), O_RDWR | O_CREAT, 0666);
+            if (_fd >= 0 && ::flock(_fd, exclusive ? LOCK_EX : LOCK_SH) != 0) {
+                ::close(_fd);
+                _fd = -1;
+            }
+#endif
+        }
+
+        DirectoryLock(const DirectoryLock&) = delete;
+        DirectoryLock& operator=(const DirectoryLock&) = delete;
+
+        ~DirectoryLock() {
+#if defined(__unix__) || defined(__APPLE__)
+            if (_fd >= 0) {
+                ::close(_fd);
+            }
+#endif
+        }
+
+    private:
+        int _fd = -1;
+    };
+
+    static uint64_t fnv(uint64_t hash, const void* data, size_t bytes) {
+        const uint8_t* p = static_cast<const uint8_t*>(data);
+        for (size_t i = 0; i < bytes; ++i) {
+            hash = (hash ^ p[i]) * 0x100000001B3ULL;
+        }
+        return hash;
+    }
+
+    // size is the total of the files; mtime folds in the name, size and time of each one
+    static Key makeKey(const std::string& source, const std::vector<std::string>& files, const std::string& format) {
+        Key key;
+        key.name = format + "\n" + std::filesystem::absolute(source).lexically_normal().string();
+        key.hash = fnv(0xCBF29CE484222325ULL, key.name.data(), key.name.size());
+        key.mtime = 0xCBF29CE484222325ULL;
+        for (const std::string& file : files) {
+            const std::string path = std::filesystem::absolute(file).lexically_normal().string();
+            const uint64_t size = std::filesystem::file_size(file);
+            const uint64_t mtime = static_cast<uint64_t>(std::filesystem::last_write_time(file).time_since_epoch().count());
+            key.size += size;
+            key.mtime = fnv(key.mtime, path.data(), path.size() + 1);
+            key.mtime = fnv(key.mtime, &size, sizeof(size));
+            key.mtime = fnv(key.mtime, &mtime, sizeof(mtime));
+        }
+        return key;
+    }
+
+    // A changed source maps to the same entry, so stale data is replaced instead of piling up
+    static std::filesystem::path entryPath(const std::string& dir, const Key& key) {
+        std::ostringstream name;
+        name << std::hex << std::setw(16) << std::setfill('0') << key.hash << ".media";
+        return std::filesystem::path(dir) / name.str();
+    }
+
+    static void evict(const std::string& dir, size_t capacity) {
+        struct Entry {
+            std::filesystem::path path;
+            std::filesystem::file_time_type used;
+            uintmax_t size;
+        };
+        std::vector<Entry> entries;
+        uintmax_t total = 0;
+        std::error_code ec;
+        for (const auto& item : std::filesystem::directory_iterator(dir, ec)) {
+            if (item.path().extension() != ".media") {
+                continue;
+            }
+            const uintmax_t size = item.file_size(ec);
+            const auto used = item.last_write_time(ec);
+            if (!ec) {
+                entries.push_back({item.path(), used, size});
+                total += size;
+            }
+        }
+        std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.used < b.used; });
+        for (const Entry& entry : entries) {
+            if (total <= capacity) {
+                break;
+            }
+            if (std::filesystem::remove(entry.path, ec)) {
+                total -= entry.size;
+            }
+        }
+    }
+};
+
+#endif